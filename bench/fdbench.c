@@ -0,0 +1,588 @@
+/** @file fdbench.c
+ *  @brief Benchmark suite for showFDtables
+ *
+ *  The harness builds a farm of processes that hold a configurable number of
+ *  file descriptors of mixed types (regular files, pipes, sockets and eventfds),
+ *  then runs showFDtables in each table mode and in the threshold, TXT and
+ *  binary paths. For each mode it reports the wall time, the CPU time and the
+ *  number of system calls per scanned FD.
+ *
+ *  Instead of real processes, the farm can be generated as a directory tree
+ *  that mimics /proc ("--proc-root=DIR"), so scan performance can be reproduced
+ *  on any machine without spawning processes.
+ *
+ *  @author Huang Xinzi
+ *  @bug No known bugs.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+#include <sys/prctl.h>
+#include <sys/ptrace.h>
+
+// The command name of every farm process (scans are restricted to it)
+#define FARM_COMM "fdfarm"
+
+// The number of distinct objects of each type the farm FDs point at
+#define OBJECT_POOL 16
+
+// The first PID of a generated /proc tree
+#define FAKE_PID_BASE 100000
+
+/** @brief One showFDtables invocation to benchmark.
+ */
+typedef struct {
+	const char *name;    // The name printed in the report
+	const char *args[4]; // The mode's arguments (NULL-terminated)
+} bench_mode;
+
+/** @brief The benchmark options.
+ */
+typedef struct {
+	int procs;             // Number of farm processes ("--procs=N")
+	int fds;               // Number of FDs per farm process ("--fds=M")
+	int runs;              // Number of timed runs per mode ("--runs=R")
+	const char *exe;       // The showFDtables executable ("--exe=PATH")
+	const char *proc_root; // A generated /proc tree to scan ("--proc-root=DIR"), or NULL
+} bench_options;
+
+/** @brief The result of one benchmarked mode.
+ */
+typedef struct {
+	double wall;           // Median wall time in milliseconds
+	double cpu;            // Median CPU (user + system) time in milliseconds
+	long syscalls;         // System calls of one run, or -1 if they cannot be counted
+} bench_result;
+
+/** @brief Display error message and then terminate the program.
+ *
+ *  @param message - A string containing the error message.
+ *  @return Void.
+ */
+void handle_error(char *message) {
+	printf("%s\n", message);
+	exit(1);
+}
+
+/** @brief Return the current time of the monotonic clock in milliseconds.
+ */
+double now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/** @brief Compare two doubles for qsort.
+ */
+int compare_doubles(const void *a, const void *b) {
+	double x = *(const double *) a, y = *(const double *) b;
+	return (x > y) - (x < y);
+}
+
+/** @brief Raise the soft limit on open files so that n FDs fit.
+ *
+ *  @param n - The number of FDs needed.
+ *  @return Void.
+ */
+void raise_fd_limit(int n) {
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < (rlim_t) n) {
+		limit.rlim_cur = limit.rlim_max < (rlim_t) n ? limit.rlim_max : (rlim_t) n;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+}
+
+/** @brief Open n FDs of mixed types in a farm process.
+ *
+ *  The FDs cycle through regular files (from a small shared pool), pipes,
+ *  socket pairs and eventfds.
+ *
+ *  @param n - The number of FDs to open.
+ *  @param dir - The directory holding the pool of regular files.
+ *  @return Void.
+ */
+void open_farm_fds(int n, const char *dir) {
+	char path[PATH_MAX];
+	int pair[2];
+
+	for (int opened = 0, i = 0; opened < n; i ++) {
+		switch (i % 4) {
+		case 1:
+			if (n - opened >= 2 && pipe(pair) == 0) {
+				opened += 2;
+				continue;
+			}
+			break;
+		case 2:
+			if (n - opened >= 2 && socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == 0) {
+				opened += 2;
+				continue;
+			}
+			break;
+		case 3:
+			if (eventfd(0, 0) != -1) {
+				opened ++;
+				continue;
+			}
+			break;
+		}
+		snprintf(path, sizeof(path), "%s/file-%d", dir, i % OBJECT_POOL);
+		if (open(path, O_RDONLY | O_CREAT, 0600) == -1) {
+			perror(path);
+			_exit(1);
+		}
+		opened ++;
+	}
+}
+
+/** @brief Spawn the farm of processes and wait until all of them are ready.
+ *
+ *  @param opt - A pointer to the benchmark options.
+ *  @param dir - The directory holding the pool of regular files.
+ *  @return The array of farm PIDs (opt -> procs entries).
+ */
+pid_t *spawn_farm(bench_options *opt, const char *dir) {
+	pid_t *farm = calloc(opt -> procs, sizeof(pid_t));
+	int ready[2];
+	if (farm == NULL || pipe(ready) != 0) {
+		handle_error("Cannot set up the process farm!");
+	}
+
+	for (int i = 0; i < opt -> procs; i ++) {
+		if ((farm[i] = fork()) == 0) {
+			// Keep exactly three standard FDs plus the farm FDs
+			int null_fd = open("/dev/null", O_RDWR);
+			dup2(null_fd, 0);
+			dup2(null_fd, 1);
+			dup2(null_fd, 2);
+			close(null_fd);
+			close(ready[0]);
+			prctl(PR_SET_NAME, FARM_COMM);
+			raise_fd_limit(opt -> fds + 16);
+			int signal_fd = fcntl(ready[1], F_DUPFD, opt -> fds + 16);
+			close(ready[1]);
+			open_farm_fds(opt -> fds, dir);
+			// Tell the parent we are ready, then keep the FDs open until killed
+			if (write(signal_fd, "", 1) != 1) {
+				_exit(1);
+			}
+			close(signal_fd);
+			while (1) {
+				pause();
+			}
+		} else if (farm[i] == -1) {
+			handle_error("Cannot fork a farm process!");
+		}
+	}
+
+	close(ready[1]);
+	char byte;
+	for (int i = 0; i < opt -> procs; i ++) {
+		if (read(ready[0], &byte, 1) != 1) {
+			handle_error("A farm process failed to open its FDs!");
+		}
+	}
+	close(ready[0]);
+	return farm;
+}
+
+/** @brief Write a small file into a generated /proc tree.
+ *
+ *  @param path - The path of the file.
+ *  @param content - The content of the file.
+ *  @return Void.
+ */
+void write_file(const char *path, const char *content) {
+	FILE *fp = fopen(path, "w");
+	if (fp == NULL) {
+		perror(path);
+		exit(1);
+	}
+	fputs(content, fp);
+	fclose(fp);
+}
+
+/** @brief Generate a directory tree that mimics /proc for the farm.
+ *
+ *  Each fake process has status, stat, comm and limits files and an fd
+ *  directory of symbolic links to a shared pool of objects: regular files,
+ *  FIFOs (for pipes), bound UNIX sockets and files named like eventfds. Its
+ *  task directory holds the leader and one thread with an FD table of its own
+ *  (a link to the process's fd directory), which "--threads" captures.
+ *  A tree generated earlier for the same farm size (recorded in its .fdbench
+ *  marker) is reused.
+ *
+ *  @param opt - A pointer to the benchmark options.
+ *  @return Void.
+ */
+void generate_proc_root(bench_options *opt) {
+	char path[PATH_MAX], link[PATH_MAX], content[512];
+	const char *root = opt -> proc_root;
+
+	// The marker records the farm size the tree was generated for
+	snprintf(path, sizeof(path), "%s/.fdbench", root);
+	snprintf(content, sizeof(content), "%d %d\n", opt -> procs, opt -> fds);
+	FILE *marker = fopen(path, "r");
+	if (marker != NULL) {
+		char size[64] = "";
+		if (fgets(size, sizeof(size), marker) == NULL || strcmp(size, content) != 0) {
+			handle_error("The generated /proc tree has a different farm size; remove it first!");
+		}
+		fclose(marker);
+		return;
+	}
+	if (mkdir(root, 0755) != 0) {
+		perror(root);
+		handle_error("--proc-root=DIR must be a new directory or a tree generated by fdbench!");
+	}
+
+	// The pool of objects the fake FDs link to
+	snprintf(path, sizeof(path), "%s/objects", root);
+	mkdir(path, 0755);
+	for (int k = 0; k < OBJECT_POOL; k ++) {
+		snprintf(path, sizeof(path), "%s/objects/file-%d", root, k);
+		write_file(path, "");
+		snprintf(path, sizeof(path), "%s/objects/pipe-%d", root, k);
+		mkfifo(path, 0600);
+		snprintf(path, sizeof(path), "%s/objects/eventfd-%d", root, k);
+		write_file(path, "");
+
+		struct sockaddr_un addr = {AF_UNIX};
+		snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/objects/socket-%d", root, k);
+		int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (sock == -1 || bind(sock, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+			// Fall back to a regular file if the path is too long to bind
+			write_file(addr.sun_path, "");
+		}
+		if (sock != -1) {
+			close(sock);
+		}
+	}
+
+	const char *types[] = {"file", "pipe", "socket", "eventfd"};
+	char *abs_root = realpath(root, NULL);
+	for (int i = 0; i < opt -> procs; i ++) {
+		int pid = FAKE_PID_BASE + i;
+		snprintf(path, sizeof(path), "%s/%d", root, pid);
+		mkdir(path, 0755);
+		snprintf(path, sizeof(path), "%s/%d/fd", root, pid);
+		mkdir(path, 0755);
+		snprintf(path, sizeof(path), "%s/%d/task", root, pid);
+		mkdir(path, 0755);
+		snprintf(path, sizeof(path), "%s/%d/task/%d", root, pid, pid);
+		mkdir(path, 0755);
+		snprintf(path, sizeof(path), "%s/%d/task/%d", root, pid, FAKE_PID_BASE + opt -> procs + i);
+		mkdir(path, 0755);
+		strcat(path, "/fd");
+		if (symlink("../../fd", path) != 0) {
+			perror(path);
+			exit(1);
+		}
+
+		snprintf(path, sizeof(path), "%s/%d/status", root, pid);
+		snprintf(content, sizeof(content), "Name:\t%s\nPid:\t%d\nUid:\t%d\t%d\t%d\t%d\n",
+			FARM_COMM, pid, getuid(), getuid(), getuid(), getuid());
+		write_file(path, content);
+		snprintf(path, sizeof(path), "%s/%d/comm", root, pid);
+		write_file(path, FARM_COMM "\n");
+		snprintf(path, sizeof(path), "%s/%d/stat", root, pid);
+		snprintf(content, sizeof(content), "%d (%s) S 1 %d %d 0 -1 0 0 0 0 0 0 0 0 0 20 0 "
+			"1 0 %d 0 0\n", pid, FARM_COMM, pid, pid, 1000 + i);
+		write_file(path, content);
+		snprintf(path, sizeof(path), "%s/%d/limits", root, pid);
+		snprintf(content, sizeof(content), "Limit                     Soft Limit           "
+			"Hard Limit           Units     \nMax open files            %-20d %-20d files     \n",
+			opt -> fds + 1024, opt -> fds + 4096);
+		write_file(path, content);
+
+		for (int fd = 0; fd < opt -> fds; fd ++) {
+			snprintf(link, sizeof(link), "%s/objects/%s-%d", abs_root, types[fd % 4],
+				(i + fd) % OBJECT_POOL);
+			snprintf(path, sizeof(path), "%s/%d/fd/%d", root, pid, fd);
+			if (symlink(link, path) != 0) {
+				perror(path);
+				exit(1);
+			}
+		}
+	}
+	free(abs_root);
+
+	snprintf(path, sizeof(path), "%s/.fdbench", root);
+	snprintf(content, sizeof(content), "%d %d\n", opt -> procs, opt -> fds);
+	write_file(path, content);
+}
+
+/** @brief Start showFDtables with its output discarded.
+ *
+ *  @param argv - The argument vector (argv[0] is the executable).
+ *  @param dir - The working directory (where the TXT and binary files go).
+ *  @param trace - 1 to stop the child for a tracer before it executes.
+ *  @return The PID of the child.
+ */
+pid_t start_child(char *const argv[], const char *dir, int trace) {
+	pid_t child = fork();
+	if (child == 0) {
+		int null_fd = open("/dev/null", O_WRONLY);
+		dup2(null_fd, 1);
+		dup2(null_fd, 2);
+		close(null_fd);
+		if (chdir(dir) != 0) {
+			_exit(127);
+		}
+		if (trace) {
+			if (ptrace(PTRACE_TRACEME, 0, NULL, NULL) != 0) {
+				_exit(126);
+			}
+			raise(SIGSTOP);
+		}
+		execv(argv[0], argv);
+		_exit(127);
+	}
+	if (child == -1) {
+		handle_error("Cannot fork showFDtables!");
+	}
+	return child;
+}
+
+/** @brief Run showFDtables once and measure its wall and CPU time.
+ *
+ *  @param argv - The argument vector (argv[0] is the executable).
+ *  @param dir - The working directory.
+ *  @param wall - A pointer to store the wall time in milliseconds.
+ *  @param cpu - A pointer to store the CPU time in milliseconds.
+ *  @return Void.
+ */
+void time_run(char *const argv[], const char *dir, double *wall, double *cpu) {
+	struct rusage usage;
+	int status;
+	double start = now_ms();
+	pid_t child = start_child(argv, dir, 0);
+	if (wait4(child, &status, 0, &usage) == -1 || !WIFEXITED(status) ||
+		WEXITSTATUS(status) != 0) {
+		handle_error("showFDtables failed during the benchmark!");
+	}
+	*wall = now_ms() - start;
+	*cpu = usage.ru_utime.tv_sec * 1e3 + usage.ru_utime.tv_usec / 1e3 +
+		usage.ru_stime.tv_sec * 1e3 + usage.ru_stime.tv_usec / 1e3;
+}
+
+/** @brief Run showFDtables once under ptrace and count its system calls.
+ *
+ *  All threads are followed. Each system call stops the tracee twice (on entry
+ *  and on exit). The farm processes are children too, but they never change
+ *  state while a run is traced.
+ *
+ *  @param argv - The argument vector (argv[0] is the executable).
+ *  @param dir - The working directory.
+ *  @return The number of system calls, or -1 if ptrace is not permitted.
+ */
+long count_syscalls(char *const argv[], const char *dir) {
+	int status;
+	long stops = 0;
+	pid_t child = start_child(argv, dir, 1);
+
+	if (waitpid(child, &status, 0) == -1 || !WIFSTOPPED(status)) {
+		waitpid(child, &status, 0);
+		return -1;
+	}
+	ptrace(PTRACE_SETOPTIONS, child, NULL, PTRACE_O_TRACESYSGOOD |
+		PTRACE_O_TRACECLONE | PTRACE_O_EXITKILL);
+	ptrace(PTRACE_SYSCALL, child, NULL, NULL);
+
+	// Stop once the thread group leader has exited (it is reported last)
+	pid_t tid;
+	while ((tid = waitpid(-1, &status, __WALL)) != -1) {
+		if (!WIFSTOPPED(status)) {
+			if (tid == child) {
+				break;
+			}
+			continue;
+		}
+		int sig = WSTOPSIG(status);
+		if (sig == (SIGTRAP | 0x80)) {
+			stops ++;
+			sig = 0;
+		} else if (sig == SIGTRAP || sig == SIGSTOP) {
+			// A clone event, or the initial stop of a new thread
+			sig = 0;
+		}
+		ptrace(PTRACE_SYSCALL, tid, NULL, (void *) (long) sig);
+	}
+	return stops / 2;
+}
+
+/** @brief Benchmark one mode: several timed runs and one traced run.
+ *
+ *  @param opt - A pointer to the benchmark options.
+ *  @param mode - A pointer to the mode.
+ *  @param dir - The working directory.
+ *  @param result - A pointer to the result to fill.
+ *  @return Void.
+ */
+void bench_one(bench_options *opt, bench_mode *mode, const char *dir, bench_result *result) {
+	char root_arg[PATH_MAX];
+	char *argv[12];
+	int argc = 0;
+
+	argv[argc ++] = (char *) opt -> exe;
+	for (int i = 0; mode -> args[i] != NULL; i ++) {
+		argv[argc ++] = (char *) mode -> args[i];
+	}
+	argv[argc ++] = "--comm=" FARM_COMM;
+	if (opt -> proc_root != NULL) {
+		char *abs_root = realpath(opt -> proc_root, NULL);
+		snprintf(root_arg, sizeof(root_arg), "--proc-root=%s", abs_root);
+		free(abs_root);
+		argv[argc ++] = root_arg;
+	}
+	argv[argc] = NULL;
+
+	double *walls = calloc(opt -> runs, sizeof(double));
+	double *cpus = calloc(opt -> runs, sizeof(double));
+	if (walls == NULL || cpus == NULL) {
+		handle_error("Out of memory while benchmarking!");
+	}
+	for (int r = 0; r < opt -> runs; r ++) {
+		time_run(argv, dir, &walls[r], &cpus[r]);
+	}
+	qsort(walls, opt -> runs, sizeof(double), compare_doubles);
+	qsort(cpus, opt -> runs, sizeof(double), compare_doubles);
+	result -> wall = walls[opt -> runs / 2];
+	result -> cpu = cpus[opt -> runs / 2];
+	result -> syscalls = count_syscalls(argv, dir);
+	free(walls);
+	free(cpus);
+}
+
+/** @brief Validate the command line arguments of the benchmark.
+ *
+ *  @param argc Number of command line arguments.
+ *  @param argv The array of strings storing command line arguments.
+ *  @param opt - A pointer to the options to fill.
+ *  @return Void.
+ */
+void vertify_arg(int argc, char *argv[], bench_options *opt) {
+	for (int i = 1; i < argc; i ++) {
+		if (sscanf(argv[i], "--procs=%d", &opt -> procs) == 1) {
+			if (opt -> procs < 1) {
+				handle_error("The value given to --procs=N should be a positive int!");
+			}
+		} else if (sscanf(argv[i], "--fds=%d", &opt -> fds) == 1) {
+			if (opt -> fds < 1) {
+				handle_error("The value given to --fds=M should be a positive int!");
+			}
+		} else if (sscanf(argv[i], "--runs=%d", &opt -> runs) == 1) {
+			if (opt -> runs < 1) {
+				handle_error("The value given to --runs=R should be a positive int!");
+			}
+		} else if (strncmp(argv[i], "--exe=", 6) == 0 && argv[i][6] != '\0') {
+			opt -> exe = argv[i] + 6;
+		} else if (strncmp(argv[i], "--proc-root=", 12) == 0 && argv[i][12] != '\0') {
+			opt -> proc_root = argv[i] + 12;
+		} else {
+			printf("Invalid arguments: \"%s\"\n", argv[i]);
+			printf("Usage: fdbench [--procs=N] [--fds=M] [--runs=R] [--exe=PATH] "
+				"[--proc-root=DIR]\n");
+			exit(1);
+		}
+	}
+}
+
+int main(int argc, char *argv[]) {
+	bench_options opt = {100, 100, 5, "./showFDtables", NULL};
+	bench_mode modes[] = {
+		{"composite",       {"--composite", NULL}},
+		{"composite -j1",   {"--composite", "--jobs=1", NULL}},
+		{"per-process",     {"--per-process", NULL}},
+		{"systemWide",      {"--systemWide", NULL}},
+		{"Vnodes",          {"--Vnodes", NULL}},
+		{"files",           {"--files", NULL}},
+		{"threshold+top",   {"--threshold=0", "--top=10", NULL}},
+		// Like a real run, the exports also print the default composite table,
+		// which start_child discards
+		{"output_TXT",      {"--output_TXT", NULL}},
+		{"output_binary",   {"--output_binary", NULL}},
+		{"resolve-sockets", {"--systemWide", "--resolve-sockets", NULL}},
+		{"fdinfo",          {"--fdinfo", NULL}},
+		{"stream",          {"--stream", NULL}},
+		{"threads",         {"--composite", "--threads", NULL}},
+		{"composite uring", {"--composite", "--io=uring", NULL}},
+		{"Vnodes uring",    {"--Vnodes", "--io=uring", NULL}},
+	};
+	int mode_count = sizeof modes / sizeof modes[0];
+	pid_t *farm = NULL;
+	char work[] = "/tmp/fdbench.XXXXXX";
+
+	vertify_arg(argc, argv, &opt);
+	char *exe = realpath(opt.exe, NULL);
+	if (exe == NULL) {
+		perror(opt.exe);
+		handle_error("Build showFDtables first (make showFDtables)!");
+	}
+	opt.exe = exe;
+	if (mkdtemp(work) == NULL) {
+		handle_error("Cannot create a working directory!");
+	}
+
+	// Every farm process holds its farm FDs plus stdin, stdout and stderr;
+	// a generated tree holds exactly the farm FDs
+	long total_fds;
+	if (opt.proc_root != NULL) {
+		generate_proc_root(&opt);
+		total_fds = (long) opt.procs * opt.fds;
+	} else {
+		farm = spawn_farm(&opt, work);
+		total_fds = (long) opt.procs * (opt.fds + 3);
+	}
+
+	printf("## showFDtables benchmark: %d processes x %d FDs (%s), median of %d runs\n",
+		opt.procs, opt.fds, opt.proc_root ? opt.proc_root : "live processes", opt.runs);
+	printf("\tMode\t\tWall ms\tCPU ms\tSyscalls\tSyscalls/FD\n");
+	printf("\t========================================\n");
+	for (int i = 0; i < mode_count; i ++) {
+		bench_result result;
+		bench_one(&opt, &modes[i], work, &result);
+		printf("\t%-15s\t%.2f\t%.2f\t", modes[i].name, result.wall, result.cpu);
+		if (result.syscalls >= 0) {
+			printf("%ld\t\t%.2f\n", result.syscalls, (double) result.syscalls / total_fds);
+		} else {
+			printf("n/a\t\tn/a\n");
+		}
+		fflush(stdout);
+	}
+	printf("\t========================================\n");
+
+	// Tear down the farm and the working directory
+	for (int i = 0; farm != NULL && i < opt.procs; i ++) {
+		kill(farm[i], SIGKILL);
+		waitpid(farm[i], NULL, 0);
+	}
+	char path[PATH_MAX];
+	for (int k = 0; k < OBJECT_POOL; k ++) {
+		snprintf(path, sizeof(path), "%s/file-%d", work, k);
+		unlink(path);
+	}
+	snprintf(path, sizeof(path), "%s/compositeTable.txt", work);
+	unlink(path);
+	snprintf(path, sizeof(path), "%s/compositeTable.bin", work);
+	unlink(path);
+	rmdir(work);
+	free(farm);
+	free(exe);
+	return 0;
+}
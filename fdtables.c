@@ -0,0 +1,2869 @@
+/** @file fdtables.c
+ *  @brief The FD table scanner library (libfdtables)
+ *
+ *  Everything that reads /proc lives here: the batched directory reader, the
+ *  process filter, the per-process FD capture, the parallel scan, the count-only
+ *  scan and the scanner handle of the public API (see fdtables.h). The
+ *  functions showFDtables shares are declared in fdtables_private.h; everything
+ *  else is static. Failures are returned with errno set, never printed.
+ *
+ *  @author Huang Xinzi
+ *  @bug No known bugs.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <linux/kcmp.h>
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#define HAVE_IO_URING 1
+#endif
+#include "fdtables_private.h"
+
+// Record a failed stat, readlink or fdinfo read in an instrumentation struct
+#define STATS_ERROR(stats, errors, err) do { \
+	if ((stats) != NULL) { \
+		stats_error((stats) -> errors, (err)); \
+	} \
+} while (0)
+
+/** @brief Read the monotonic clock for a phase timing.
+ *
+ *  @param stats - The instrumentation of the scan, or NULL.
+ *  @return The time in nanoseconds, or 0 without instrumentation.
+ */
+uint64_t stats_clock(const fdt_stats *stats) {
+	struct timespec ts;
+	if (stats == NULL) {
+		return 0;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/** @brief Add the time elapsed since start to a phase.
+ *
+ *  @param stats - The instrumentation of the scan, or NULL.
+ *  @param phase - The phase (one of the FDT_PHASE_* values).
+ *  @param start - The time returned by stats_clock when the phase started.
+ *  @return Void.
+ */
+static void stats_phase(fdt_stats *stats, int phase, uint64_t start) {
+	STATS_ADD(stats, phase_ns[phase], stats_clock(stats) - start);
+}
+
+/** @brief Record a failed stat or readlink.
+ *
+ *  @param errors - The per-errno counters to update.
+ *  @param err - The errno value.
+ *  @return Void.
+ */
+static void stats_error(uint64_t *errors, int err) {
+	__atomic_fetch_add(&errors[err > 0 && err < FDT_STATS_MAX_ERRNO ? err : 0], 1,
+		__ATOMIC_RELAXED);
+}
+
+/** @brief Record that a process could not be opened.
+ *
+ *  @param stats - The instrumentation of the scan, or NULL.
+ *  @param err - The errno value of the failed open.
+ *  @return Void.
+ */
+static void stats_lost_process(fdt_stats *stats, int err) {
+	if (err == ENOENT || err == ESRCH) {
+		STATS_ADD(stats, procs_vanished, 1);
+	} else {
+		STATS_ADD(stats, procs_unreadable, 1);
+	}
+}
+
+/** @brief Grow a dynamic array so that it can hold at least one more element.
+ *
+ *  @param array - A pointer to the array pointer.
+ *  @param cap - A pointer to the current capacity (in elements).
+ *  @param count - The number of elements currently in use.
+ *  @param size - The size of one element.
+ *  @return 0 on success, -1 if out of memory (the array is left unchanged).
+ */
+int grow_array(void **array, size_t *cap, size_t count, size_t size) {
+	if (count < *cap) {
+		return 0;
+	}
+	size_t new_cap = *cap ? *cap * 2 : 64;
+	void *tmp = realloc(*array, new_cap * size);
+	if (tmp == NULL) {
+		return -1;
+	}
+	*array = tmp;
+	*cap = new_cap;
+	return 0;
+}
+
+/** @brief Allocate memory from an arena.
+ *
+ *  The memory is bumped from the current block; when it does not fit, the
+ *  next kept block is reused or a new one is added. Nothing is freed until
+ *  the arena is reset.
+ *
+ *  @param pool - A pointer to the arena.
+ *  @param size - The number of bytes needed.
+ *  @return A pointer to the memory (not aligned, meant for strings), or NULL
+ * 			if out of memory.
+ */
+static void *arena_alloc(arena *pool, size_t size) {
+	arena_block *block = pool -> current;
+	while (block != NULL && block -> used + size > block -> size) {
+		// A block left behind by a reset is reused from the start
+		if ((block = block -> next) != NULL) {
+			block -> used = 0;
+			pool -> current = block;
+		}
+	}
+	if (block == NULL) {
+		size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+		if ((block = malloc(sizeof(arena_block) + block_size)) == NULL) {
+			return NULL;
+		}
+		block -> size = block_size;
+		block -> used = 0;
+		// Keep the blocks in allocation order after the current one
+		if (pool -> current != NULL) {
+			block -> next = pool -> current -> next;
+			pool -> current -> next = block;
+		} else {
+			block -> next = pool -> head;
+			pool -> head = block;
+		}
+		pool -> current = block;
+	}
+	void *mem = block -> data + block -> used;
+	block -> used += size;
+	return mem;
+}
+
+/** @brief Empty an arena but keep its blocks for the next allocations.
+ *
+ *  @param pool - A pointer to the arena.
+ *  @return Void.
+ */
+static void arena_reset(arena *pool) {
+	pool -> current = pool -> head;
+	if (pool -> head != NULL) {
+		pool -> head -> used = 0;
+	}
+}
+
+/** @brief Release all blocks of an arena.
+ *
+ *  @param pool - A pointer to the arena.
+ *  @return Void.
+ */
+static void arena_free(arena *pool) {
+	while (pool -> head != NULL) {
+		arena_block *next = pool -> head -> next;
+		free(pool -> head);
+		pool -> head = next;
+	}
+	pool -> current = NULL;
+}
+
+/** @brief Hash a string of the given length (FNV-1a).
+ *
+ *  @param str - The string.
+ *  @param len - Its length.
+ *  @return The hash value.
+ */
+static uint32_t hash_bytes(const char *str, size_t len) {
+	uint32_t h = 2166136261u;
+	for (size_t i = 0; i < len; i ++) {
+		h = (h ^ (unsigned char) str[i]) * 16777619u;
+	}
+	return h;
+}
+
+/** @brief Find the slot of a string in a string pool, interning the string first
+ *  if it is not there yet.
+ *
+ *  @param pool - A pointer to the string pool.
+ *  @param str - The string (need not be null-terminated).
+ *  @param len - Its length.
+ *  @return The index of the string's slot, or SIZE_MAX if out of memory.
+ */
+static size_t pool_slot(string_pool *pool, const char *str, size_t len) {
+	// Keep the load factor at most 1/2
+	if (2 * (pool -> count + 1) > pool -> cap) {
+		size_t new_cap = pool -> cap ? pool -> cap * 2 : 1024;
+		const char **slots = calloc(new_cap, sizeof(const char *));
+		uint32_t *hashes = malloc(new_cap * sizeof(uint32_t));
+		size_t *offsets = malloc(new_cap * sizeof(size_t));
+		if (slots == NULL || hashes == NULL || offsets == NULL) {
+			free(slots);
+			free(hashes);
+			free(offsets);
+			return SIZE_MAX;
+		}
+		for (size_t i = 0; i < pool -> cap; i ++) {
+			if (pool -> slots[i] != NULL) {
+				size_t j = pool -> hashes[i] & (new_cap - 1);
+				while (slots[j] != NULL) {
+					j = (j + 1) & (new_cap - 1);
+				}
+				slots[j] = pool -> slots[i];
+				hashes[j] = pool -> hashes[i];
+				offsets[j] = pool -> offsets[i];
+			}
+		}
+		free(pool -> slots);
+		free(pool -> hashes);
+		free(pool -> offsets);
+		pool -> slots = slots;
+		pool -> hashes = hashes;
+		pool -> offsets = offsets;
+		pool -> cap = new_cap;
+	}
+
+	uint32_t h = hash_bytes(str, len);
+	size_t i = h & (pool -> cap - 1);
+	for (; pool -> slots[i] != NULL; i = (i + 1) & (pool -> cap - 1)) {
+		if (pool -> hashes[i] == h && strncmp(pool -> slots[i], str, len) == 0 &&
+			pool -> slots[i][len] == '\0') {
+			return i;
+		}
+	}
+	char *copy = arena_alloc(&pool -> strings, len + 1);
+	if (copy == NULL) {
+		return SIZE_MAX;
+	}
+	memcpy(copy, str, len);
+	copy[len] = '\0';
+	pool -> slots[i] = copy;
+	pool -> hashes[i] = h;
+	pool -> offsets[i] = pool -> size;
+	pool -> size += len + 1;
+	pool -> count ++;
+	return i;
+}
+
+/** @brief Store a string once in a string pool.
+ *
+ *  Equal strings interned in the same pool get the same pointer, so the
+ *  thousands of FDs on /dev/null or on a shared log file cost one copy.
+ *
+ *  @param pool - A pointer to the string pool.
+ *  @param str - The string (need not be null-terminated).
+ *  @param len - Its length.
+ *  @return The interned, null-terminated copy; valid until the pool is reset.
+ * 			NULL if out of memory.
+ */
+static const char *pool_string(string_pool *pool, const char *str, size_t len) {
+	size_t i = pool_slot(pool, str, len); // May grow the table
+	return i != SIZE_MAX ? pool -> slots[i] : NULL;
+}
+
+/** @brief Store a string once in a string pool and return its offset in the
+ *  pool's string table (see pool_write).
+ *
+ *  @param pool - A pointer to the string pool.
+ *  @param str - The string (need not be null-terminated).
+ *  @param len - Its length.
+ *  @return The offset of the interned string, or SIZE_MAX if out of memory.
+ */
+size_t pool_offset(string_pool *pool, const char *str, size_t len) {
+	size_t i = pool_slot(pool, str, len); // May grow the table
+	return i != SIZE_MAX ? pool -> offsets[i] : SIZE_MAX;
+}
+
+/** @brief Write the string table of a pool: every interned string, null-terminated,
+ *  in the order the strings were first interned (pool -> size bytes).
+ *
+ *  The arena hands out its blocks in that order and keeps the strings of a
+ *  block back to back, so the table is the used part of each block up to the
+ *  current one.
+ *
+ *  @param pool - A pointer to the string pool.
+ *  @param file - The file to write to.
+ *  @return 0 on success, -1 on a write error.
+ */
+int pool_write(const string_pool *pool, FILE *file) {
+	for (arena_block *block = pool -> strings.head; pool -> count > 0 && block != NULL;
+		block = block -> next) {
+		if (fwrite(block -> data, 1, block -> used, file) != block -> used) {
+			return -1;
+		}
+		if (block == pool -> strings.current) {
+			break;
+		}
+	}
+	return 0;
+}
+
+/** @brief Empty a string pool but keep its table and arena blocks.
+ *
+ *  @param pool - A pointer to the string pool.
+ *  @return Void.
+ */
+static void pool_reset(string_pool *pool) {
+	if (pool -> count > 0) {
+		memset(pool -> slots, 0, pool -> cap * sizeof(const char *));
+		pool -> count = 0;
+	}
+	pool -> size = 0;
+	arena_reset(&pool -> strings);
+}
+
+/** @brief Release all memory held by a string pool.
+ *
+ *  @param pool - A pointer to the string pool.
+ *  @return Void.
+ */
+void pool_free(string_pool *pool) {
+	free(pool -> slots);
+	free(pool -> hashes);
+	free(pool -> offsets);
+	arena_free(&pool -> strings);
+	memset(pool, 0, sizeof(*pool));
+}
+
+/** @brief Release all memory held by a snapshot.
+ *
+ *  @param snap - A pointer to the snapshot.
+ *  @return Void.
+ */
+void free_snapshot(fdt_snapshot *snap) {
+	free(snap -> pid);
+	free(snap -> fd);
+	free(snap -> inode);
+	free(snap -> dev);
+	free(snap -> mode);
+	free(snap -> link);
+	free(snap -> endpoint);
+	free(snap -> pos);
+	free(snap -> flags);
+	free(snap -> mnt_id);
+	free(snap -> access_mode);
+	free(snap -> procs);
+	pool_free(&snap -> strings);
+	memset(snap, 0, sizeof(*snap));
+}
+
+/** @brief Empty a snapshot but keep its columns and string storage for the next scan.
+ *
+ *  @param snap - A pointer to the snapshot.
+ *  @return Void.
+ */
+void clear_snapshot(fdt_snapshot *snap) {
+	snap -> fields = 0;
+	snap -> fd_count = 0;
+	snap -> proc_count = 0;
+	pool_reset(&snap -> strings);
+}
+
+/** @brief Resize one column of a snapshot.
+ *
+ *  @param column - A pointer to the column pointer.
+ *  @param cap - The new capacity (in elements).
+ *  @param size - The size of one element.
+ *  @return 0 on success, -1 if out of memory (the column is left unchanged).
+ */
+static int resize_column(void *column, size_t cap, size_t size) {
+	void *tmp = realloc(*(void **) column, cap * size);
+	if (tmp == NULL) {
+		return -1;
+	}
+	*(void **) column = tmp;
+	return 0;
+}
+
+/** @brief Append a record to a snapshot.
+ *
+ *  The link target and the endpoint are interned into the snapshot, so the
+ *  strings of rec may be temporary. The fdinfo columns are only kept once the
+ *  snapshot's fields include FDT_FIELD_FDINFO, and the access column once they
+ *  include FDT_FIELD_ACCESS.
+ *
+ *  @param snap - A pointer to the snapshot.
+ *  @param rec - A pointer to the record (its link must not be NULL).
+ *  @return 0 on success, -1 if out of memory (the record is not added).
+ */
+int add_record(fdt_snapshot *snap, const fdt_record *rec) {
+	if (snap -> fd_count == snap -> fd_cap) {
+		size_t cap = snap -> fd_cap ? snap -> fd_cap * 2 : 64;
+		// A column that grew before a failure keeps its larger size
+		if (resize_column(&snap -> pid, cap, sizeof(int)) != 0 ||
+			resize_column(&snap -> fd, cap, sizeof(int)) != 0 ||
+			resize_column(&snap -> inode, cap, sizeof(ino_t)) != 0 ||
+			resize_column(&snap -> dev, cap, sizeof(dev_t)) != 0 ||
+			resize_column(&snap -> mode, cap, sizeof(mode_t)) != 0 ||
+			resize_column(&snap -> link, cap, sizeof(const char *)) != 0 ||
+			(snap -> endpoint != NULL &&
+				resize_column(&snap -> endpoint, cap, sizeof(const char *)) != 0) ||
+			(snap -> pos != NULL && (resize_column(&snap -> pos, cap, sizeof(int64_t)) != 0 ||
+				resize_column(&snap -> flags, cap, sizeof(int)) != 0 ||
+				resize_column(&snap -> mnt_id, cap, sizeof(int)) != 0)) ||
+			(snap -> access_mode != NULL &&
+				resize_column(&snap -> access_mode, cap, sizeof(int)) != 0)) {
+			errno = ENOMEM;
+			return -1;
+		}
+		snap -> fd_cap = cap;
+	}
+	if ((snap -> fields & FDT_FIELD_FDINFO) && snap -> pos == NULL) {
+		int64_t *pos = malloc(snap -> fd_cap * sizeof(int64_t));
+		int *flags = malloc(snap -> fd_cap * sizeof(int));
+		int *mnt_id = malloc(snap -> fd_cap * sizeof(int));
+		if (pos == NULL || flags == NULL || mnt_id == NULL) {
+			free(pos);
+			free(flags);
+			free(mnt_id);
+			errno = ENOMEM;
+			return -1;
+		}
+		snap -> pos = pos;
+		snap -> flags = flags;
+		snap -> mnt_id = mnt_id;
+	}
+	if ((snap -> fields & FDT_FIELD_ACCESS) && snap -> access_mode == NULL &&
+		resize_column(&snap -> access_mode, snap -> fd_cap, sizeof(int)) != 0) {
+		errno = ENOMEM;
+		return -1;
+	}
+	const char *link = pool_string(&snap -> strings, rec -> link, strlen(rec -> link));
+	if (link == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	size_t i = snap -> fd_count;
+	if (snap -> endpoint != NULL) {
+		snap -> endpoint[i] = NULL;
+	}
+	if (rec -> endpoint != NULL && set_endpoint(snap, i, rec -> endpoint) != 0) {
+		return -1;
+	}
+	snap -> fd_count ++;
+	snap -> pid[i] = rec -> pid;
+	snap -> fd[i] = rec -> fd;
+	snap -> inode[i] = rec -> inode;
+	snap -> dev[i] = rec -> dev;
+	snap -> mode[i] = rec -> mode;
+	snap -> link[i] = link;
+	if (snap -> pos != NULL) {
+		snap -> pos[i] = rec -> pos;
+		snap -> flags[i] = rec -> flags;
+		snap -> mnt_id[i] = rec -> mnt_id;
+	}
+	if (snap -> access_mode != NULL) {
+		snap -> access_mode[i] = rec -> access_mode;
+	}
+	return 0;
+}
+
+/** @brief Fill the row view of a record.
+ *
+ *  @param snap - A pointer to the snapshot.
+ *  @param i - The index of the record.
+ *  @param rec - A pointer to the row to fill; its strings stay valid until
+ * 				 the snapshot is cleared.
+ *  @return Void.
+ */
+void fdt_get_record(const fdt_snapshot *snap, size_t i, fdt_record *rec) {
+	rec -> pid = snap -> pid[i];
+	rec -> fd = snap -> fd[i];
+	rec -> inode = snap -> inode[i];
+	rec -> dev = snap -> dev[i];
+	rec -> mode = snap -> mode[i];
+	rec -> link = snap -> link[i];
+	rec -> endpoint = snap -> endpoint != NULL ? snap -> endpoint[i] : NULL;
+	rec -> pos = snap -> pos != NULL ? snap -> pos[i] : -1;
+	rec -> flags = snap -> pos != NULL ? snap -> flags[i] : -1;
+	rec -> mnt_id = snap -> pos != NULL ? snap -> mnt_id[i] : -1;
+	rec -> access_mode = snap -> access_mode != NULL ? snap -> access_mode[i] : 0;
+}
+
+/** @brief Set the endpoint of a record, adding the endpoint column on first use.
+ *
+ *  @param snap - A pointer to the snapshot.
+ *  @param i - The index of the record.
+ *  @param endpoint - The endpoint (interned into the snapshot), or NULL.
+ *  @return 0 on success, -1 if out of memory (errno is set).
+ */
+int set_endpoint(fdt_snapshot *snap, size_t i, const char *endpoint) {
+	const char *interned = NULL;
+	if (snap -> endpoint == NULL) {
+		if (endpoint == NULL) {
+			return 0;
+		}
+		if ((snap -> endpoint = calloc(snap -> fd_cap, sizeof(const char *))) == NULL) {
+			errno = ENOMEM;
+			return -1;
+		}
+	}
+	if (endpoint != NULL &&
+		(interned = pool_string(&snap -> strings, endpoint, strlen(endpoint))) == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	snap -> endpoint[i] = interned;
+	return 0;
+}
+
+/** @brief The position of a record while sorting (see sort_records).
+ */
+typedef struct {
+	int fd;        // The file descriptor number
+	size_t index;  // The index of the record in the snapshot
+} record_order;
+
+/** @brief Compare two records by file descriptor for qsort.
+ *
+ *  @param a - A pointer to the first record_order.
+ *  @param b - A pointer to the second record_order.
+ *  @return A negative, zero or positive value like strcmp.
+ */
+static int compare_order(const void *a, const void *b) {
+	int x = ((const record_order *) a) -> fd;
+	int y = ((const record_order *) b) -> fd;
+	return (x > y) - (x < y);
+}
+
+/** @brief Reorder a range of one column.
+ *
+ *  @param column - The column.
+ *  @param size - The size of one element.
+ *  @param first - The index of the first record of the range.
+ *  @param order - The new order of the range.
+ *  @param count - The number of records in the range.
+ *  @param tmp - A buffer of count elements of the column.
+ *  @return Void.
+ */
+static void permute_column(void *column, size_t size, size_t first,
+	const record_order *order, size_t count, char *tmp) {
+	char *base = column;
+	for (size_t i = 0; i < count; i ++) {
+		memcpy(tmp + i * size, base + order[i].index * size, size);
+	}
+	memcpy(base + first * size, tmp, count * size);
+}
+
+/** @brief Sort a range of records (usually one process) by file descriptor.
+ *
+ *  /proc lists the FDs in ascending order, so the range is only permuted
+ *  when it is not sorted already.
+ *
+ *  @param snap - A pointer to the snapshot.
+ *  @param first - The index of the first record of the range.
+ *  @param count - The number of records in the range.
+ *  @return 0 on success, -1 if out of memory (the range is left unsorted).
+ */
+int sort_records(fdt_snapshot *snap, size_t first, size_t count) {
+	size_t i = 1;
+	while (i < count && snap -> fd[first + i - 1] <= snap -> fd[first + i]) {
+		i ++;
+	}
+	if (i >= count) {
+		return 0;
+	}
+
+	record_order *order = malloc(count * sizeof(record_order));
+	char *tmp = malloc(count * sizeof(uint64_t));
+	if (order == NULL || tmp == NULL) {
+		free(order);
+		free(tmp);
+		errno = ENOMEM;
+		return -1;
+	}
+	for (i = 0; i < count; i ++) {
+		order[i].fd = snap -> fd[first + i];
+		order[i].index = first + i;
+	}
+	qsort(order, count, sizeof(record_order), compare_order);
+	permute_column(snap -> pid, sizeof(int), first, order, count, tmp);
+	permute_column(snap -> fd, sizeof(int), first, order, count, tmp);
+	permute_column(snap -> inode, sizeof(ino_t), first, order, count, tmp);
+	permute_column(snap -> dev, sizeof(dev_t), first, order, count, tmp);
+	permute_column(snap -> mode, sizeof(mode_t), first, order, count, tmp);
+	permute_column(snap -> link, sizeof(const char *), first, order, count, tmp);
+	if (snap -> endpoint != NULL) {
+		permute_column(snap -> endpoint, sizeof(const char *), first, order, count, tmp);
+	}
+	if (snap -> pos != NULL) {
+		permute_column(snap -> pos, sizeof(int64_t), first, order, count, tmp);
+		permute_column(snap -> flags, sizeof(int), first, order, count, tmp);
+		permute_column(snap -> mnt_id, sizeof(int), first, order, count, tmp);
+	}
+	if (snap -> access_mode != NULL) {
+		permute_column(snap -> access_mode, sizeof(int), first, order, count, tmp);
+	}
+	free(order);
+	free(tmp);
+	return 0;
+}
+
+/** @brief The layout of one record returned by getdents64.
+ */
+struct linux_dirent64 {
+	ino64_t d_ino;
+	off64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+/** @brief Return the name of the next numeric entry of a directory.
+ *
+ *  Entries whose name does not start with a digit (such as . and ..) are
+ *  skipped, since only PIDs and FD numbers are of interest.
+ *
+ *  @param reader - A pointer to the reader; reader -> fd must be set and
+ * 				    reader -> len / reader -> pos zeroed before the first call.
+ *  @return The entry name, or NULL at the end of the directory or on error.
+ */
+const char *next_dent(dent_reader *reader) {
+	while (1) {
+		if (reader -> pos >= reader -> len) {
+			reader -> len = syscall(SYS_getdents64, reader -> fd, reader -> buf,
+				sizeof(reader -> buf));
+			reader -> pos = 0;
+			if (reader -> len <= 0) {
+				return NULL;
+			}
+		}
+		struct linux_dirent64 *dent = (struct linux_dirent64 *) (reader -> buf + reader -> pos);
+		reader -> pos += dent -> d_reclen;
+		if (isdigit(dent -> d_name[0]) > 0) {
+			return dent -> d_name;
+		}
+	}
+}
+
+/** @brief Open the proc root directory of a scan (/proc by default).
+ *
+ *  @param options - A pointer to the scanner options.
+ *  @return A directory file descriptor, or -1 on error.
+ */
+int open_proc_root(const fdt_options *options) {
+	return open(options -> proc_root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+#ifdef STATX_INO
+// Cleared at runtime if the kernel does not implement statx
+static int use_statx = 1;
+#endif
+
+/** @brief Get the inode, device and mode of the file an FD entry links to.
+ *
+ *  The lookup is relative to the process' fd directory, so the kernel does not
+ *  resolve /proc/[PID]/fd again for each descriptor. statx is used with a
+ *  minimal mask when available, otherwise fstatat.
+ *
+ *  @param fd_dir - A file descriptor of the /proc/[PID]/fd directory.
+ *  @param name - The entry name (i.e. the FD number).
+ *  @param rec - A pointer to the record to fill.
+ *  @return 0 on success, -1 on error (with errno set).
+ */
+static int stat_fd_entry(int fd_dir, const char *name, fdt_record *rec) {
+#ifdef STATX_INO
+	if (__atomic_load_n(&use_statx, __ATOMIC_RELAXED)) {
+		struct statx stx;
+		if (statx(fd_dir, name, 0, STATX_TYPE | STATX_MODE | STATX_INO, &stx) == 0) {
+			rec -> inode = stx.stx_ino;
+			rec -> dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+			rec -> mode = stx.stx_mode;
+			return 0;
+		}
+		if (errno != ENOSYS) {
+			return -1;
+		}
+		__atomic_store_n(&use_statx, 0, __ATOMIC_RELAXED);
+	}
+#endif
+	struct stat finfo; // A variable to store file information
+	if (fstatat(fd_dir, name, &finfo, 0) != 0) {
+		return -1;
+	}
+	rec -> inode = finfo.st_ino;
+	rec -> dev = finfo.st_dev;
+	rec -> mode = finfo.st_mode;
+	return 0;
+}
+
+#if defined(HAVE_IO_URING) && defined(STATX_INO) && defined(SYS_io_uring_setup)
+/** @brief The statx calls of an fd directory queued on an io_uring.
+ *
+ *  Each thread has its own batch (see statx_batch_get). A queued call fills
+ *  the inode, device and mode columns of a record already in the snapshot, so
+ *  the record is appended right away and completed by statx_batch_flush. Once
+ *  io_uring fails, the flag of the scanner filling the snapshot is set (see
+ *  fdt_snapshot.uring_failed), so only that scanner falls back to synchronous
+ *  stats.
+ */
+typedef struct {
+	int ring_fd;                   // The io_uring file descriptor
+	void *sq_ring;                 // The mapped submission ring
+	void *cq_ring;                 // The mapped completion ring (may be sq_ring)
+	size_t sq_ring_size;           // The mapped size of sq_ring
+	size_t cq_ring_size;           // The mapped size of cq_ring
+	struct io_uring_sqe *sqes;     // The mapped submission queue entries
+	size_t sqes_size;              // The mapped size of sqes
+	unsigned *sq_tail;             // The submission ring's tail (shared with the kernel)
+	unsigned sq_mask;              // The submission ring's index mask
+	unsigned *sq_array;            // The submission ring's indices into sqes
+	unsigned *cq_head;             // The completion ring's head (shared with the kernel)
+	unsigned *cq_tail;             // The completion ring's tail (shared with the kernel)
+	unsigned cq_mask;              // The completion ring's index mask
+	struct io_uring_cqe *cqes;     // The completion queue entries
+	unsigned entries;              // The number of calls submitted at once
+	unsigned queued;               // The number of calls queued
+	struct statx *results;         // The result buffer of each queued call
+	char (*names)[16];             // The entry name (FD number) of each queued call
+	size_t *records;               // The record each queued call fills, or SIZE_MAX once done
+	int broken;                    // 1 once the ring failed; it is replaced by statx_batch_get
+	int *failed;                   // The fallback flag of the current scanner, or NULL
+	fdt_stats *stats;              // The instrumentation of the current scan, or NULL
+} statx_batch;
+
+static pthread_key_t batch_key;                         // Each thread's statx_batch
+static pthread_once_t batch_once = PTHREAD_ONCE_INIT;   // Creates batch_key
+
+/** @brief Unmap and close the io_uring of a batch, and free the batch.
+ *
+ *  @param arg - A pointer to the statx_batch.
+ *  @return Void.
+ */
+static void statx_batch_free(void *arg) {
+	statx_batch *batch = arg;
+	if (batch -> sqes != NULL && batch -> sqes != MAP_FAILED) {
+		munmap(batch -> sqes, batch -> sqes_size);
+	}
+	if (batch -> cq_ring != NULL && batch -> cq_ring != MAP_FAILED &&
+		batch -> cq_ring != batch -> sq_ring) {
+		munmap(batch -> cq_ring, batch -> cq_ring_size);
+	}
+	if (batch -> sq_ring != NULL && batch -> sq_ring != MAP_FAILED) {
+		munmap(batch -> sq_ring, batch -> sq_ring_size);
+	}
+	if (batch -> ring_fd != -1) {
+		close(batch -> ring_fd);
+	}
+	free(batch -> results);
+	free(batch -> names);
+	free(batch -> records);
+	free(batch);
+}
+
+/** @brief Create the io_uring of a batch and map its rings.
+ *
+ *  @param entries - The number of calls submitted at once.
+ *  @return A pointer to the batch, or NULL if io_uring is unavailable.
+ */
+static statx_batch *statx_batch_open(unsigned entries) {
+	struct io_uring_params params;
+	statx_batch *batch = calloc(1, sizeof(statx_batch));
+	if (batch == NULL) {
+		return NULL;
+	}
+	memset(&params, 0, sizeof(params));
+	batch -> ring_fd = syscall(SYS_io_uring_setup, entries, &params);
+	batch -> entries = entries;
+	batch -> results = calloc(entries, sizeof(struct statx));
+	batch -> names = calloc(entries, sizeof(*batch -> names));
+	batch -> records = calloc(entries, sizeof(size_t));
+	if (batch -> ring_fd == -1 || batch -> results == NULL || batch -> names == NULL ||
+		batch -> records == NULL) {
+		statx_batch_free(batch);
+		return NULL;
+	}
+
+	// Map the rings (a single mapping holds both on recent kernels)
+	batch -> sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	batch -> cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (batch -> cq_ring_size > batch -> sq_ring_size) {
+			batch -> sq_ring_size = batch -> cq_ring_size;
+		}
+		batch -> cq_ring_size = batch -> sq_ring_size;
+	}
+	batch -> sq_ring = mmap(NULL, batch -> sq_ring_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, batch -> ring_fd, IORING_OFF_SQ_RING);
+	batch -> cq_ring = (params.features & IORING_FEAT_SINGLE_MMAP) ? batch -> sq_ring :
+		mmap(NULL, batch -> cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			batch -> ring_fd, IORING_OFF_CQ_RING);
+	batch -> sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	batch -> sqes = mmap(NULL, batch -> sqes_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, batch -> ring_fd, IORING_OFF_SQES);
+	if (batch -> sq_ring == MAP_FAILED || batch -> cq_ring == MAP_FAILED ||
+		batch -> sqes == MAP_FAILED) {
+		statx_batch_free(batch);
+		return NULL;
+	}
+	char *sq = batch -> sq_ring, *cq = batch -> cq_ring;
+	batch -> sq_tail = (unsigned *) (sq + params.sq_off.tail);
+	batch -> sq_mask = *(unsigned *) (sq + params.sq_off.ring_mask);
+	batch -> sq_array = (unsigned *) (sq + params.sq_off.array);
+	batch -> cq_head = (unsigned *) (cq + params.cq_off.head);
+	batch -> cq_tail = (unsigned *) (cq + params.cq_off.tail);
+	batch -> cq_mask = *(unsigned *) (cq + params.cq_off.ring_mask);
+	batch -> cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+	return batch;
+}
+
+/** @brief Create the key of the per-thread batches (freed when their thread exits).
+ *
+ *  @return Void.
+ */
+static void statx_batch_key(void) {
+	pthread_key_create(&batch_key, statx_batch_free);
+}
+
+/** @brief Make a scanner stat its FD entries synchronously from now on.
+ *
+ *  @param failed - The fallback flag of the scanner, or NULL.
+ *  @return Void.
+ */
+static void statx_batch_fail(int *failed) {
+	if (failed != NULL) {
+		__atomic_store_n(failed, 1, __ATOMIC_RELAXED);
+	}
+}
+
+/** @brief Get the calling thread's batch if FD entries are stat'ed through io_uring.
+ *
+ *  @param options - A pointer to the scanner options (io, io_batch and stats).
+ *  @param snap - A pointer to the snapshot being filled; its uring_failed flag
+ * 				  tells whether io_uring already failed for its scanner.
+ *  @return A pointer to the batch, or NULL to stat the entries synchronously.
+ */
+static statx_batch *statx_batch_get(const fdt_options *options, fdt_snapshot *snap) {
+	if (options -> io != FDT_IO_URING ||
+		(snap -> uring_failed != NULL && __atomic_load_n(snap -> uring_failed, __ATOMIC_RELAXED))) {
+		return NULL;
+	}
+	pthread_once(&batch_once, statx_batch_key);
+	statx_batch *batch = pthread_getspecific(batch_key);
+	// A batch left by a scanner with another batch size, or whose ring failed,
+	// is replaced
+	if (batch != NULL && (batch -> entries != options -> io_batch || batch -> broken)) {
+		statx_batch_free(batch);
+		pthread_setspecific(batch_key, NULL);
+		batch = NULL;
+	}
+	if (batch == NULL) {
+		// io_uring may be missing, or disabled (kernel.io_uring_disabled, seccomp)
+		if ((batch = statx_batch_open(options -> io_batch)) == NULL) {
+			statx_batch_fail(snap -> uring_failed);
+			return NULL;
+		}
+		pthread_setspecific(batch_key, batch);
+	}
+	batch -> failed = snap -> uring_failed;
+	batch -> stats = options -> stats;
+	return batch;
+}
+
+/** @brief Fill the stat columns of a record.
+ *
+ *  @param batch - A pointer to the batch.
+ *  @param snap - A pointer to the snapshot holding the record.
+ *  @param i - The index of the record.
+ *  @param res - The result of the stat (0, or a negated errno).
+ *  @param rec - The inode, device and mode (only read if res is 0).
+ *  @return Void.
+ */
+static void statx_batch_fill(statx_batch *batch, fdt_snapshot *snap, size_t i, int res,
+	const fdt_record *rec) {
+	if (res != 0) {
+		STATS_ERROR(batch -> stats, stat_errors, -res);
+		return;
+	}
+	snap -> inode[i] = rec -> inode;
+	snap -> dev[i] = rec -> dev;
+	snap -> mode[i] = rec -> mode;
+	STATS_ADD(batch -> stats, fds_stated, 1);
+}
+
+/** @brief Fill the stat columns of a record from the result of its statx call.
+ *
+ *  @param batch - A pointer to the batch.
+ *  @param slot - The slot of the call in the batch.
+ *  @param res - The result of the call (0, or a negated errno).
+ *  @param fd_dir - A file descriptor of the /proc/[PID]/fd directory.
+ *  @param snap - A pointer to the snapshot holding the record.
+ *  @return Void.
+ */
+static void statx_batch_complete(statx_batch *batch, unsigned slot, int res, int fd_dir,
+	fdt_snapshot *snap) {
+	size_t i = batch -> records[slot];
+	fdt_record rec;
+	batch -> records[slot] = SIZE_MAX;
+	if (res == -EINVAL || res == -EOPNOTSUPP) {
+		// The kernel does not know IORING_OP_STATX: this scanner stats
+		// synchronously from now on
+		statx_batch_fail(batch -> failed);
+		res = stat_fd_entry(fd_dir, batch -> names[slot], &rec) == 0 ? 0 : -errno;
+	} else if (res == 0) {
+		struct statx *stx = &batch -> results[slot];
+		rec.inode = stx -> stx_ino;
+		rec.dev = makedev(stx -> stx_dev_major, stx -> stx_dev_minor);
+		rec.mode = stx -> stx_mode;
+	}
+	statx_batch_fill(batch, snap, i, res, &rec);
+}
+
+/** @brief Submit the queued statx calls and wait for all of them to complete.
+ *
+ *  If the kernel is short of resources or its completion queue is full
+ *  (EAGAIN, EBUSY), the calls in flight are reaped before the rest is
+ *  submitted again. If nothing is in flight to wait for, or the ring fails
+ *  otherwise, the ring is marked broken, the scanner falls back to
+ *  synchronous stats, and the calls that did not complete are stat'ed here.
+ *
+ *  @param batch - A pointer to the batch.
+ *  @param fd_dir - The fd directory the calls are relative to.
+ *  @param snap - A pointer to the snapshot holding the records.
+ *  @return Void.
+ */
+static void statx_batch_flush(statx_batch *batch, int fd_dir, fdt_snapshot *snap) {
+	unsigned submitted = 0, done = 0;
+	int reap_only = 0;     // 1 to wait for completions without submitting
+	if (batch -> queued == 0) {
+		return;
+	}
+	uint64_t start = stats_clock(batch -> stats);
+	STATS_ADD(batch -> stats, uring_batches, 1);
+	while (done < batch -> queued) {
+		int ret = syscall(SYS_io_uring_enter, batch -> ring_fd,
+			reap_only ? 0 : batch -> queued - submitted, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+		reap_only = 0;
+		if (ret < 0 && (errno == EAGAIN || errno == EBUSY) && submitted > done) {
+			reap_only = 1;
+		} else if (ret < 0 && errno != EINTR) {
+			// The ring is unusable: stat the calls that did not complete synchronously
+			batch -> broken = 1;
+			statx_batch_fail(batch -> failed);
+			for (unsigned slot = 0; slot < batch -> queued; slot ++) {
+				if (batch -> records[slot] != SIZE_MAX) {
+					statx_batch_complete(batch, slot, -EINVAL, fd_dir, snap);
+				}
+			}
+			break;
+		}
+		submitted += ret > 0 ? ret : 0;
+
+		// Reap every completion that arrived
+		unsigned head = *batch -> cq_head;
+		unsigned tail = __atomic_load_n(batch -> cq_tail, __ATOMIC_ACQUIRE);
+		for (; head != tail; head ++, done ++) {
+			struct io_uring_cqe *cqe = &batch -> cqes[head & batch -> cq_mask];
+			statx_batch_complete(batch, cqe -> user_data, cqe -> res, fd_dir, snap);
+		}
+		__atomic_store_n(batch -> cq_head, head, __ATOMIC_RELEASE);
+	}
+	batch -> queued = 0;
+	stats_phase(batch -> stats, FDT_PHASE_STAT, start);
+}
+
+/** @brief Queue the statx call of an FD entry, submitting the batch once it is full.
+ *
+ *  @param batch - A pointer to the batch.
+ *  @param fd_dir - A file descriptor of the /proc/[PID]/fd directory.
+ *  @param name - The entry name (i.e. the FD number).
+ *  @param snap - A pointer to the snapshot holding the record.
+ *  @param i - The index of the record whose stat columns the call fills.
+ *  @return Void.
+ */
+static void statx_batch_add(statx_batch *batch, int fd_dir, const char *name,
+	fdt_snapshot *snap, size_t i) {
+	if (batch -> broken) {
+		// The ring failed earlier in this fd directory
+		fdt_record rec;
+		int res = stat_fd_entry(fd_dir, name, &rec) == 0 ? 0 : -errno;
+		statx_batch_fill(batch, snap, i, res, &rec);
+		return;
+	}
+	unsigned slot = batch -> queued ++;
+	unsigned tail = *batch -> sq_tail;
+	unsigned index = tail & batch -> sq_mask;
+	struct io_uring_sqe *sqe = &batch -> sqes[index];
+
+	snprintf(batch -> names[slot], sizeof(batch -> names[slot]), "%s", name);
+	batch -> records[slot] = i;
+	memset(sqe, 0, sizeof(*sqe));
+	sqe -> opcode = IORING_OP_STATX;
+	sqe -> fd = fd_dir;
+	sqe -> addr = (uintptr_t) batch -> names[slot];
+	sqe -> len = STATX_TYPE | STATX_MODE | STATX_INO;
+	sqe -> off = (uintptr_t) &batch -> results[slot];
+	sqe -> user_data = slot;
+	batch -> sq_array[index] = index;
+	__atomic_store_n(batch -> sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	if (batch -> queued == batch -> entries) {
+		statx_batch_flush(batch, fd_dir, snap);
+	}
+}
+#else
+// Without io_uring, every FD entry is stat'ed synchronously
+typedef struct statx_batch statx_batch;
+
+static statx_batch *statx_batch_get(const fdt_options *options, fdt_snapshot *snap) {
+	return NULL;
+}
+
+static void statx_batch_flush(statx_batch *batch, int fd_dir, fdt_snapshot *snap) {
+}
+
+static void statx_batch_add(statx_batch *batch, int fd_dir, const char *name,
+	fdt_snapshot *snap, size_t i) {
+}
+#endif
+
+/** @brief Read the offset, open flags and mount ID of a file descriptor.
+ *
+ *  These are the first three lines of /proc/[PID]/fdinfo/[FD]; the lines
+ *  that follow for some file types (epoll, inotify, ...) are not read.
+ *
+ *  @param fdinfo_dir - A file descriptor of the /proc/[PID]/fdinfo directory.
+ *  @param name - The FD number (the entry name).
+ *  @param rec - A pointer to the record whose pos, flags and mnt_id are filled.
+ *  @return 0 on success, -1 on error (with errno set).
+ */
+static int read_fdinfo(int fdinfo_dir, const char *name, fdt_record *rec) {
+	char buf[256];
+	long long pos;
+	unsigned int flags;
+	int fd = openat(fdinfo_dir, name, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		return -1;
+	}
+	ssize_t len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len < 0) {
+		return -1;
+	}
+	buf[len] = '\0';
+	if (sscanf(buf, "pos: %lld flags: %o mnt_id: %d", &pos, &flags, &rec -> mnt_id) != 3) {
+		errno = EINVAL;
+		return -1;
+	}
+	rec -> pos = pos;
+	rec -> flags = flags;
+	return 0;
+}
+
+/** @brief Open the /proc/[PID] directory of a process.
+ *
+ *  @param proc_fd - A file descriptor of the /proc directory, or -1 to open
+ * 				     the directory by its full path.
+ *  @param pid - The process ID.
+ *  @param options - A pointer to the scanner options (proc_root and stats).
+ *  @return A directory file descriptor, or -1 on error.
+ */
+int open_pid_dir(int proc_fd, int pid, const fdt_options *options) {
+	char path[PATH_MAX]; // A string indicating the path to the /proc/[PID] directory
+	if (proc_fd == -1) {
+		snprintf(path, sizeof(path), "%s/%d", options -> proc_root, pid);
+	} else {
+		sprintf(path, "%d", pid);
+	}
+	int pid_dir = openat(proc_fd == -1 ? AT_FDCWD : proc_fd, path,
+		O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (pid_dir == -1) {
+		stats_lost_process(options -> stats, errno);
+	}
+	return pid_dir;
+}
+
+/** @brief Capture the FD table of a process with the given pid into a snapshot.
+ * 
+ * 	The function opens the file descriptor directory for the given process and reads
+ *  each file descriptor in the directory. Only the requested fields are fetched:
+ *  each descriptor is stat'ed, its link is read and its fdinfo is parsed at most
+ *  once (relative to the fd and fdinfo directories), so a scan without fields
+ *  costs a single directory enumeration. The result is appended to the snapshot.
+ * 	
+ *  @param pid - An integer that represents the process ID of the given files
+ *  @param pid_dir - A file descriptor of the /proc/[PID] directory.
+ *  @param options - A pointer to the scanner options: the fields to fetch
+ * 				     (FDT_FIELD_* flags; the others are left empty: 0, "" or -1),
+ * 				     the I/O backend and the instrumentation.
+ *  @param snap - A pointer to the snapshot to fill.
+ *  @return 0 on success, including a process that cannot be read (it is only
+ * 			counted in the instrumentation), or -1 if out of memory (errno is set).
+ */
+int show_FD(int pid, int pid_dir, const fdt_options *options, fdt_snapshot *snap) {
+	const char *name;      // The current entry name (i.e. the FD number)
+	dent_reader *reader;   // A batched reader of the fd directory
+	int fields = options -> fields;
+	fdt_stats *stats = options -> stats;
+	int ret = 0;
+
+    // If cannot open the dictionary, the function returns
+    int fd_dir = openat(pid_dir, "fd", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd_dir == -1) {
+    	stats_lost_process(stats, errno);
+        return 0;
+    }
+    STATS_ADD(stats, procs_scanned, 1);
+    // Record the process before its file descriptors
+    if ((reader = malloc(sizeof(dent_reader))) == NULL ||
+    	grow_array((void **) &snap -> procs, &snap -> proc_cap, snap -> proc_count,
+    	sizeof(proc_record)) != 0) {
+    	free(reader);
+    	close(fd_dir);
+    	errno = ENOMEM;
+    	return -1;
+    }
+    reader -> fd = fd_dir;
+    reader -> len = reader -> pos = 0;
+    snap -> fields |= fields;
+
+    // The fdinfo directory is only opened if its fields are requested
+    int fdinfo_dir = -1;
+    if (fields & FDT_FIELD_FDINFO) {
+    	fdinfo_dir = openat(pid_dir, "fdinfo", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    }
+    // With FDT_IO_URING, the stats are queued and fill the records in batches
+    statx_batch *batch = (fields & FDT_FIELD_STAT) ? statx_batch_get(options, snap) : NULL;
+
+    proc_record *proc = &snap -> procs[snap -> proc_count ++];
+    proc -> pid = pid;
+    proc -> first = snap -> fd_count;
+    proc -> fd_num = 0;
+
+    // Loop the /proc/[PID]/fd directory to get each file descriptor's information
+    while ((name = next_dent(reader)) != NULL) {
+    	fdt_record row;
+    	fdt_record *rec = &row;
+    	rec -> pid = pid;
+    	rec -> fd = atoi(name);
+    	rec -> endpoint = NULL;
+    	STATS_ADD(stats, fds_seen, 1);
+    	uint64_t start = stats_clock(stats);
+
+    	// Get entry's information. A failure is only counted
+    	if (!(fields & FDT_FIELD_STAT) || batch != NULL) {
+    		rec -> inode = 0;
+    		rec -> dev = 0;
+    		rec -> mode = 0;
+    	} else if (stat_fd_entry(fd_dir, name, rec) != 0) {
+        	STATS_ERROR(stats, stat_errors, errno);
+        	rec -> inode = 0;
+        	rec -> dev = 0;
+        	rec -> mode = 0;
+        } else {
+        	STATS_ADD(stats, fds_stated, 1);
+        }
+
+        char link[PATH_MAX]; // A variable storing the file name
+   		ssize_t r;           // A variable storing the link size
+
+   		// If r < 0, an error occurs with the readlinkat() function
+		if (!(fields & FDT_FIELD_LINK)) {
+			r = 0;
+		} else if ((r = readlinkat(fd_dir, name, link, sizeof(link) - 1)) < 0) {
+			STATS_ERROR(stats, readlink_errors, errno);
+		    r = 0;
+		}
+
+		// The mode of the fd link itself tells which ends of a pipe the FD
+		// holds, e.g. the write end is "l-wx------"
+		rec -> access_mode = 0;
+		if ((fields & FDT_FIELD_ACCESS) && r >= 6 && memcmp(link, "pipe:[", 6) == 0) {
+			struct stat linfo;
+			if (fstatat(fd_dir, name, &linfo, AT_SYMLINK_NOFOLLOW) == 0) {
+				rec -> access_mode = linfo.st_mode & (S_IRUSR | S_IWUSR);
+			}
+		}
+
+		// A failed fdinfo read is only counted; the record keeps its other fields
+		if (fdinfo_dir == -1 || read_fdinfo(fdinfo_dir, name, rec) != 0) {
+			if (fdinfo_dir != -1) {
+				STATS_ERROR(stats, fdinfo_errors, errno);
+			}
+			rec -> pos = -1;
+			rec -> flags = -1;
+			rec -> mnt_id = -1;
+		}
+		stats_phase(stats, FDT_PHASE_STAT, start);
+
+		// readlinkat() does not append a terminating null byte to link,
+		// So we manually add a terminating null to link
+   		link[r] = '\0';
+   		rec -> link = link;
+   		if (add_record(snap, rec) != 0) {
+   			ret = -1;
+   			break;
+   		}
+   		if (batch != NULL) {
+   			statx_batch_add(batch, fd_dir, name, snap, snap -> fd_count - 1);
+   		}
+
+		// Count how many file descriptors in this process
+        proc -> fd_num ++;
+    }
+
+    if (batch != NULL) {
+    	statx_batch_flush(batch, fd_dir, snap);
+    }
+
+    // Close the dictionary
+    free(reader);
+    close(fd_dir);
+    if (fdinfo_dir != -1) {
+    	close(fdinfo_dir);
+    }
+    if (ret != 0) {
+    	errno = ENOMEM;
+    }
+    return ret;
+}
+
+/** @brief Compare two PIDs for sorting and searching PID sets.
+ *
+ *  @param a - A pointer to the first PID.
+ *  @param b - A pointer to the second PID.
+ *  @return A negative, zero, or positive value if a is less than, equal to, or
+ * 			greater than b.
+ */
+static int compare_pids(const void *a, const void *b) {
+	int x = *(const int *) a, y = *(const int *) b;
+	return (x > y) - (x < y);
+}
+
+/** @brief Check whether a PID lies in the filter's PID range (and in its PID set).
+ *
+ *  @param filter - A pointer to the process filter.
+ *  @param pid - The process ID.
+ *  @return 1 if the PID is in range, 0 otherwise.
+ */
+int filter_pid(const fdt_filter *filter, int pid) {
+	if (pid < filter -> pid_min || (filter -> pid_max != -1 && pid > filter -> pid_max)) {
+		return 0;
+	}
+	return filter -> pids == NULL ||
+		bsearch(&pid, filter -> pids, filter -> pid_count, sizeof(int), compare_pids) != NULL;
+}
+
+/** @brief Take the next PID to visit that passes filter_pid.
+ *
+ *  The PIDs come from the filter's PID set if it has one, so /proc is not
+ *  enumerated; otherwise they are read from /proc with the reader.
+ *
+ *  @param reader - A reader of the /proc directory (unused with a PID set).
+ *  @param options - A pointer to the scanner options (the filter and stats).
+ *  @param index - The position in the PID set, starting from 0.
+ *  @return The PID, or -1 once every PID has been visited.
+ */
+int next_pid(dent_reader *reader, const fdt_options *options, size_t *index) {
+	const fdt_filter *filter = &options -> filter;
+	const char *name;
+	if (filter -> pids != NULL) {
+		while (*index < filter -> pid_count) {
+			int pid = filter -> pids[(*index) ++];
+			STATS_ADD(options -> stats, procs_visited, 1);
+			if (pid >= filter -> pid_min && (filter -> pid_max == -1 || pid <= filter -> pid_max)) {
+				return pid;
+			}
+			STATS_ADD(options -> stats, procs_skipped, 1);
+		}
+		return -1;
+	}
+	while ((name = next_dent(reader)) != NULL) {
+		STATS_ADD(options -> stats, procs_visited, 1);
+		if (filter_pid(filter, atoi(name))) {
+			return atoi(name);
+		}
+		STATS_ADD(options -> stats, procs_skipped, 1);
+	}
+	return -1;
+}
+
+/** @brief Append the PIDs listed in a file (separated by white space) to a PID set.
+ *
+ *  @param dir_fd - The directory a relative path is opened from (e.g. AT_FDCWD).
+ *  @param path - The path of the file (e.g. a PID file or a cgroup.procs file).
+ *  @param pids - A pointer to the PID array, allocated even if no PID is listed.
+ *  @param count - A pointer to the number of PIDs in the array.
+ *  @param cap - A pointer to the capacity of the array.
+ *  @return 0 on success, -1 if the file cannot be read, lists something else
+ * 			than PIDs or the PIDs do not fit in memory (errno is set).
+ */
+int read_pid_file(int dir_fd, const char *path, int **pids, size_t *count, size_t *cap) {
+	char buf[4096];          // A chunk of the file
+	size_t len = 0;          // Bytes of buf not parsed yet
+	ssize_t got;
+
+	if (grow_array((void **) pids, cap, *count, sizeof(int)) != 0) {
+		errno = ENOMEM;
+		return -1;
+	}
+	int fd = openat(dir_fd, path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		return -1;
+	}
+	// Parse the file chunk by chunk, keeping a PID cut at the end of a chunk
+	while ((got = read(fd, buf + len, sizeof(buf) - 1 - len)) > 0 || len > 0) {
+		if (got < 0) {
+			break;
+		}
+		len += got;
+		buf[len] = '\0';
+		char *p = buf, *end;
+		while (*p != '\0') {
+			if (isspace((unsigned char) *p)) {
+				p ++;
+				continue;
+			}
+			long pid = strtol(p, &end, 10);
+			if (end == p || pid <= 0 || pid > INT_MAX ||
+				(*end != '\0' && !isspace((unsigned char) *end))) {
+				close(fd);
+				errno = EINVAL;
+				return -1;
+			}
+			if (*end == '\0' && got > 0) {
+				break; // The PID may continue in the next chunk
+			}
+			if (grow_array((void **) pids, cap, *count, sizeof(int)) != 0) {
+				close(fd);
+				errno = ENOMEM;
+				return -1;
+			}
+			(*pids)[(*count) ++] = pid;
+			p = end;
+		}
+		len = strlen(p);
+		memmove(buf, p, len);
+		if (got == 0) {
+			break;
+		}
+	}
+	close(fd);
+	return got < 0 ? -1 : 0;
+}
+
+/** @brief Append the processes of a cgroup and of its descendants to a PID set.
+ *
+ *  @param dir_fd - A file descriptor of the cgroup directory (closed on return).
+ *  @param pids - A pointer to the PID array.
+ *  @param count - A pointer to the number of PIDs in the array.
+ *  @param cap - A pointer to the capacity of the array.
+ *  @return 0 on success, -1 if the cgroup's cgroup.procs cannot be read or a
+ * 			PID set does not fit in memory.
+ */
+static int walk_cgroup(int dir_fd, int **pids, size_t *count, size_t *cap) {
+	if (read_pid_file(dir_fd, "cgroup.procs", pids, count, cap) != 0) {
+		close(dir_fd);
+		return -1;
+	}
+	DIR *dir = fdopendir(dir_fd);
+	if (dir == NULL) {
+		close(dir_fd);
+		return 0;
+	}
+	// Every subdirectory of a cgroup is a child cgroup (e.g. the containers of a pod)
+	struct dirent *dent;
+	while ((dent = readdir(dir)) != NULL) {
+		if (dent -> d_type != DT_DIR || dent -> d_name[0] == '.') {
+			continue;
+		}
+		int child = openat(dirfd(dir), dent -> d_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		// A child may vanish meanwhile, but running out of memory is an error
+		if (child != -1 && walk_cgroup(child, pids, count, cap) != 0 && errno == ENOMEM) {
+			closedir(dir);
+			return -1;
+		}
+	}
+	closedir(dir);
+	return 0;
+}
+
+/** @brief Append the processes of a cgroup (including its child cgroups) to a PID set.
+ *
+ *  Only the cgroup.procs files are read, so selecting one container costs a few
+ *  reads however many processes run on the host.
+ *
+ *  @param path - The cgroup directory; a relative path is taken from /sys/fs/cgroup.
+ *  @param pids - A pointer to the PID array, allocated even if the cgroup is empty.
+ *  @param count - A pointer to the number of PIDs in the array.
+ *  @param cap - A pointer to the capacity of the array.
+ *  @return 0 on success, -1 if the path is not a readable cgroup or the PID set
+ * 			does not fit in memory (errno is set).
+ */
+int read_cgroup_pids(const char *path, int **pids, size_t *count, size_t *cap) {
+	char full[PATH_MAX];
+	if (path[0] != '/') {
+		snprintf(full, sizeof(full), "/sys/fs/cgroup/%s", path);
+		path = full;
+	}
+	if (grow_array((void **) pids, cap, *count, sizeof(int)) != 0) {
+		errno = ENOMEM;
+		return -1;
+	}
+	int dir_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dir_fd == -1) {
+		return -1;
+	}
+	return walk_cgroup(dir_fd, pids, count, cap);
+}
+
+/** @brief Sort a PID set in ascending order and remove the duplicates.
+ *
+ *  @param pids - The PID array.
+ *  @param count - The number of PIDs.
+ *  @return The number of distinct PIDs.
+ */
+size_t sort_pids(int *pids, size_t count) {
+	size_t kept = 0;
+	qsort(pids, count, sizeof(int), compare_pids);
+	for (size_t i = 0; i < count; i ++) {
+		if (kept == 0 || pids[kept - 1] != pids[i]) {
+			pids[kept ++] = pids[i];
+		}
+	}
+	return kept;
+}
+
+/** @brief Check whether a thread shares the FD table of its process.
+ *
+ *  kcmp compares the kernel's file tables, so it is only asked about the real
+ *  /proc (not about another proc root given in the options).
+ *
+ *  @param pid - The process ID.
+ *  @param tid - The thread ID.
+ *  @param options - A pointer to the scanner options.
+ *  @return 1 if the table is shared, 0 if not or if it cannot be told.
+ */
+static int shares_fd_table(int pid, int tid, const fdt_options *options) {
+#ifdef SYS_kcmp
+	if (strcmp(options -> proc_root, "/proc") == 0) {
+		return syscall(SYS_kcmp, pid, tid, KCMP_FILES, 0, 0) == 0;
+	}
+#endif
+	return 0;
+}
+
+/** @brief Capture the FD tables of the threads of a process that do not share its table.
+ *
+ *  Threads normally share the FD table of their process, so only the threads
+ *  that have a table of their own (e.g. after unshare(CLONE_FILES)) are
+ *  captured, each as a process record with the thread ID as its PID. A thread
+ *  whose sharing cannot be checked is captured as well.
+ *
+ *  @param pid - The process ID.
+ *  @param pid_dir - A file descriptor of the /proc/[PID] directory.
+ *  @param options - A pointer to the scanner options.
+ *  @param snap - A pointer to the snapshot to fill.
+ *  @return 0 on success, -1 if out of memory (errno is set).
+ */
+static int scan_tasks(int pid, int pid_dir, const fdt_options *options, fdt_snapshot *snap) {
+	const char *name;
+	int ret = 0;
+	dent_reader *reader = malloc(sizeof(dent_reader));
+	if (reader == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	if ((reader -> fd = openat(pid_dir, "task", O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1) {
+		free(reader);
+		return 0;
+	}
+	reader -> len = reader -> pos = 0;
+	while (ret == 0 && (name = next_dent(reader)) != NULL) {
+		int tid = atoi(name);
+		if (tid == pid || shares_fd_table(pid, tid, options)) {
+			continue;
+		}
+		int task_dir = openat(reader -> fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (task_dir != -1) {
+			ret = show_FD(tid, task_dir, options, snap);
+			close(task_dir);
+		}
+	}
+	close(reader -> fd);
+	free(reader);
+	if (ret != 0) {
+		errno = ENOMEM;
+	}
+	return ret;
+}
+
+/** @brief Read the real UID of a process from /proc/[PID]/status.
+ *
+ *  @param proc_fd - A file descriptor of the /proc directory.
+ *  @param pid - The process ID.
+ *  @param uid - A pointer to store the real UID.
+ *  @return 0 on success, -1 if the status file cannot be read or parsed.
+ */
+static int read_real_uid(int proc_fd, int pid, uid_t *uid) {
+	char path[50];     // The path of /proc/[PID]/status relative to /proc
+	char buf[2048];    // The head of "/proc/[PID]/status" (the Uid line is near the top)
+	unsigned long value;
+
+	sprintf(path, "%d/status", pid);
+	int fd = openat(proc_fd, path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		return -1;
+	}
+	ssize_t len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len <= 0) {
+		return -1;
+	}
+	buf[len] = '\0';
+	char *line = strstr(buf, "\nUid:");
+	if (line == NULL || sscanf(line + 5, "%lu", &value) != 1) {
+		return -1;
+	}
+	*uid = value;
+	return 0;
+}
+
+/** @brief Check whether a process passes the owner and command name filters.
+ *
+ *  The owner is the real UID of the process. The /proc/[PID] directory is
+ *  owned by the effective UID, which is the real UID for ordinary processes,
+ *  so one fstatat decides for every process not owned by root. A root-owned
+ *  directory is ambiguous: it belongs to root's own processes, but also to
+ *  set-user-ID root programs (su, sudo, passwd) run by other users and to
+ *  non-dumpable processes. Nothing cheaper than the status file tells them
+ *  apart (the fd directory of a non-dumpable process is as inaccessible as
+ *  one of root's), so for those the real UID is read from /proc/[PID]/status,
+ *  and each read is counted in stats -> procs_status_reads. Only a process
+ *  running with another non-root effective UID is judged by its effective UID.
+ *
+ *  @param filter - A pointer to the process filter.
+ *  @param proc_fd - A file descriptor of the /proc directory.
+ *  @param pid - The process ID (already checked with filter_pid).
+ *  @param stats - The instrumentation to update, or NULL.
+ *  @return 1 if the process passes the filter, 0 otherwise.
+ */
+static int check_process(const fdt_filter *filter, int proc_fd, int pid, fdt_stats *stats) {
+	char path[50];   // The path of /proc/[PID] or /proc/[PID]/comm relative to /proc
+
+	sprintf(path, "%d", pid);
+	if (!filter -> all_users) {
+		struct stat pinfo;
+		if (fstatat(proc_fd, path, &pinfo, 0) != 0) {
+			return 0;
+		}
+		uid_t uid = pinfo.st_uid;
+		if (uid == 0) {
+			STATS_ADD(stats, procs_status_reads, 1);
+			if (read_real_uid(proc_fd, pid, &uid) != 0) {
+				return 0;
+			}
+		}
+		if (uid != filter -> uid) {
+			return 0;
+		}
+	}
+
+	if (filter -> comm != NULL) {
+		char comm[64];   // The command name of the process
+		sprintf(path, "%d/comm", pid);
+		int fd = openat(proc_fd, path, O_RDONLY | O_CLOEXEC);
+		if (fd == -1) {
+			return 0;
+		}
+		ssize_t len = read(fd, comm, sizeof(comm) - 1);
+		close(fd);
+		if (len <= 0) {
+			return 0;
+		}
+		// Strip the trailing newline
+		comm[comm[len - 1] == '\n' ? len - 1 : len] = '\0';
+		if (fnmatch(filter -> comm, comm, 0) != 0) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/** @brief Apply check_process, timing it and counting rejected processes.
+ *
+ *  @param options - A pointer to the scanner options (the filter and stats).
+ *  @param proc_fd - A file descriptor of the /proc directory.
+ *  @param pid - The process ID (already checked with filter_pid).
+ *  @return 1 if the process passes the filter, 0 otherwise.
+ */
+int filter_process(const fdt_options *options, int proc_fd, int pid) {
+	uint64_t start = stats_clock(options -> stats);
+	int accepted = check_process(&options -> filter, proc_fd, pid, options -> stats);
+	stats_phase(options -> stats, FDT_PHASE_FILTER, start);
+	if (!accepted) {
+		STATS_ADD(options -> stats, procs_skipped, 1);
+	}
+	return accepted;
+}
+
+/** @brief Capture the FD table of a PID if it passes the process filter.
+ *
+ *  @param proc_fd - A file descriptor of the /proc directory.
+ *  @param pid - The process ID (already checked with filter_pid).
+ *  @param options - A pointer to the scanner options.
+ *  @param snap - A pointer to the snapshot to fill.
+ *  @return 0 on success (also if the process is skipped or vanished), -1 if
+ * 			out of memory (errno is set).
+ */
+static int scan_process(int proc_fd, int pid, const fdt_options *options, fdt_snapshot *snap) {
+	// If the process passes the filter (by default: its owner is the current
+	// user), capture the FD table of the process (i.e. call show_FD)
+	if (!filter_process(options, proc_fd, pid)) {
+		return 0;
+	}
+	int pid_dir = open_pid_dir(proc_fd, pid, options);
+	if (pid_dir == -1) {
+		return 0;
+	}
+	int ret = show_FD(pid, pid_dir, options, snap);
+	if (ret == 0 && options -> filter.tasks) {
+		ret = scan_tasks(pid, pid_dir, options, snap);
+	}
+	close(pid_dir);
+	return ret;
+}
+
+/** @brief The range of PID indices still to be scanned by one worker thread.
+ */
+typedef struct {
+	pthread_mutex_t lock;  // Protects lo and hi
+	size_t lo;             // The next index the worker takes from its own range
+	size_t hi;             // One past the last index; thieves take from here
+} work_range;
+
+/** @brief Where the result of one PID ended up after a parallel scan.
+ */
+typedef struct {
+	int worker;      // The worker that scanned the PID, or -1 if not captured
+	size_t proc;     // Index of the first process record in that worker's snapshot
+	size_t count;    // Number of process records (the process and its tasks)
+} scan_slot;
+
+/** @brief State shared by all worker threads of a parallel scan.
+ */
+typedef struct {
+	int *pids;             // The PIDs to scan, in /proc order
+	int proc_fd;           // A file descriptor of the /proc directory
+	const fdt_options *options; // The scanner options
+	int jobs;              // Number of worker threads
+	work_range *ranges;    // One range of PID indices per worker
+	fdt_snapshot *local;    // One private snapshot per worker
+	scan_slot *slots;      // One slot per PID, filled by the worker that scanned it
+} scan_queue;
+
+/** @brief Arguments passed to a worker thread.
+ */
+typedef struct {
+	scan_queue *queue;     // The shared queue
+	int id;                // The worker's index
+	int error;             // The errno value that stopped the worker, or 0
+} scan_worker;
+
+/** @brief Take the next PID index for a worker, stealing work if needed.
+ *
+ *  A worker first takes indices from the front of its own range. Once its range
+ *  is empty it steals the back half of the largest remaining range of another
+ *  worker, so a few processes with huge FD tables do not stall the others.
+ *
+ *  @param queue - A pointer to the shared queue.
+ *  @param id - The worker's index.
+ *  @param index - A pointer to store the taken index.
+ *  @return 1 if an index was taken, 0 if all work is done.
+ */
+static int take_work(scan_queue *queue, int id, size_t *index) {
+	work_range *own = &queue -> ranges[id];
+
+	while (1) {
+		pthread_mutex_lock(&own -> lock);
+		if (own -> lo < own -> hi) {
+			*index = own -> lo ++;
+			pthread_mutex_unlock(&own -> lock);
+			return 1;
+		}
+		pthread_mutex_unlock(&own -> lock);
+
+		// Find the victim with the most remaining work
+		int victim = -1;
+		size_t most = 0;
+		for (int i = 0; i < queue -> jobs; i ++) {
+			work_range *r = &queue -> ranges[i];
+			pthread_mutex_lock(&r -> lock);
+			if (i != id && r -> hi - r -> lo > most) {
+				most = r -> hi - r -> lo;
+				victim = i;
+			}
+			pthread_mutex_unlock(&r -> lock);
+		}
+		if (victim == -1) {
+			return 0;
+		}
+
+		// Steal the back half of the victim's range (it may have shrunk meanwhile)
+		work_range *r = &queue -> ranges[victim];
+		size_t lo = 0, hi = 0;
+		pthread_mutex_lock(&r -> lock);
+		if (r -> lo < r -> hi) {
+			hi = r -> hi;
+			lo = r -> hi - (r -> hi - r -> lo + 1) / 2;
+			r -> hi = lo;
+		}
+		pthread_mutex_unlock(&r -> lock);
+
+		if (lo < hi) {
+			pthread_mutex_lock(&own -> lock);
+			own -> lo = lo;
+			own -> hi = hi;
+			pthread_mutex_unlock(&own -> lock);
+		}
+	}
+}
+
+/** @brief The body of a worker thread: scan PIDs until no work is left.
+ *
+ *  A worker that runs out of memory records the error and stops; the other
+ *  workers take over its remaining PIDs.
+ *
+ *  @param arg - A pointer to the worker's scan_worker arguments.
+ *  @return NULL.
+ */
+static void *scan_thread(void *arg) {
+	scan_worker *worker = arg;
+	scan_queue *queue = worker -> queue;
+	fdt_snapshot *local = &queue -> local[worker -> id];
+	size_t index;
+
+	while (take_work(queue, worker -> id, &index)) {
+		size_t before = local -> proc_count;
+		if (scan_process(queue -> proc_fd, queue -> pids[index], queue -> options, local) != 0) {
+			worker -> error = errno;
+			break;
+		}
+		if (local -> proc_count > before) {
+			queue -> slots[index].worker = worker -> id;
+			queue -> slots[index].proc = before;
+			queue -> slots[index].count = local -> proc_count - before;
+		}
+	}
+	return NULL;
+}
+
+/** @brief Scan a list of PIDs with several worker threads.
+ *
+ *  Each worker collects the records of its PIDs into a private snapshot. The
+ *  results are then merged in the order of the PID list, so the snapshot is the
+ *  same as the one a single-threaded scan produces.
+ *
+ *  @param snap - A pointer to the snapshot to fill.
+ *  @param proc_fd - A file descriptor of the /proc directory.
+ *  @param pids - The PIDs to scan, in /proc order.
+ *  @param count - The number of PIDs.
+ *  @param options - A pointer to the scanner options.
+ *  @param jobs - The number of worker threads.
+ *  @return 0 on success, -1 if out of memory (errno is set; the snapshot holds
+ * 			the processes merged before the failure).
+ */
+static int parallel_scan(fdt_snapshot *snap, int proc_fd, int *pids, size_t count,
+	const fdt_options *options, int jobs) {
+	scan_queue queue = {pids, proc_fd, options, jobs, NULL, NULL, NULL};
+	pthread_t *threads = calloc(jobs, sizeof(pthread_t));
+	scan_worker *workers = calloc(jobs, sizeof(scan_worker));
+	int error = 0;
+	queue.ranges = calloc(jobs, sizeof(work_range));
+	queue.local = calloc(jobs, sizeof(fdt_snapshot));
+	queue.slots = calloc(count, sizeof(scan_slot));
+	if (!threads || !workers || !queue.ranges || !queue.local || !queue.slots) {
+		free(queue.slots);
+		free(queue.local);
+		free(queue.ranges);
+		free(workers);
+		free(threads);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	// Split the PID list into one contiguous range per worker
+	for (size_t i = 0; i < count; i ++) {
+		queue.slots[i].worker = -1;
+	}
+	for (int i = 0; i < jobs; i ++) {
+		pthread_mutex_init(&queue.ranges[i].lock, NULL);
+		queue.ranges[i].lo = count * i / jobs;
+		queue.ranges[i].hi = count * (i + 1) / jobs;
+		workers[i].queue = &queue;
+		workers[i].id = i;
+		queue.local[i].uring_failed = snap -> uring_failed;
+	}
+
+	int started = 0;
+	for (; started < jobs; started ++) {
+		if (pthread_create(&threads[started], NULL, scan_thread, &workers[started]) != 0) {
+			break;
+		}
+	}
+	// If no thread could be started, do the work on this thread
+	if (started == 0) {
+		scan_thread(&workers[0]);
+	}
+	for (int i = 0; i < started; i ++) {
+		pthread_join(threads[i], NULL);
+	}
+	for (int i = 0; i < jobs && error == 0; i ++) {
+		error = workers[i].error;
+	}
+
+	snap -> fields |= options -> fields;
+	// Merge the per-worker results in PID list order. The link strings are
+	// interned again into the merged snapshot, whose pool outlives the workers'.
+	for (size_t i = 0; error == 0 && i < count; i ++) {
+		if (queue.slots[i].worker == -1) {
+			continue;
+		}
+		fdt_snapshot *local = &queue.local[queue.slots[i].worker];
+		for (size_t k = 0; error == 0 && k < queue.slots[i].count; k ++) {
+			proc_record *src = &local -> procs[queue.slots[i].proc + k];
+
+			if (grow_array((void **) &snap -> procs, &snap -> proc_cap, snap -> proc_count,
+				sizeof(proc_record)) != 0) {
+				error = ENOMEM;
+				break;
+			}
+			proc_record *proc = &snap -> procs[snap -> proc_count ++];
+			*proc = *src;
+			proc -> first = snap -> fd_count;
+			for (int j = 0; j < src -> fd_num; j ++) {
+				fdt_record rec;
+				fdt_get_record(local, src -> first + j, &rec);
+				if (add_record(snap, &rec) != 0) {
+					proc -> fd_num = j;
+					error = ENOMEM;
+					break;
+				}
+			}
+		}
+	}
+
+	for (int i = 0; i < jobs; i ++) {
+		pthread_mutex_destroy(&queue.ranges[i].lock);
+		free_snapshot(&queue.local[i]);
+	}
+	free(queue.slots);
+	free(queue.local);
+	free(queue.ranges);
+	free(workers);
+	free(threads);
+	if (error != 0) {
+		errno = error;
+		return -1;
+	}
+	return 0;
+}
+
+/** @brief List the PIDs of /proc (or of the PID set) that pass filter_pid.
+ *
+ *  @param proc_fd - A file descriptor of the /proc directory.
+ *  @param options - A pointer to the scanner options (the filter and stats).
+ *  @param pids - A pointer to the PID array to allocate (freed by the caller).
+ *  @return The number of PIDs, in /proc order, or -1 if out of memory (errno
+ * 			is set and *pids is NULL).
+ */
+static ssize_t list_pids(int proc_fd, const fdt_options *options, int **pids) {
+	int pid;                       // The current PID
+	dent_reader *reader;           // A batched reader of the /proc directory
+	size_t count = 0, cap = 0;     // Number of PIDs and capacity of pids
+	size_t index = 0;              // The position in the PID set
+
+	*pids = NULL;
+	if ((reader = malloc(sizeof(dent_reader))) == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	reader -> fd = proc_fd;
+	reader -> len = reader -> pos = 0;
+
+	// Collect every subdirectory whose name is a number (i.e. PID) in range
+	uint64_t start = stats_clock(options -> stats);
+	while ((pid = next_pid(reader, options, &index)) != -1) {
+		if (grow_array((void **) pids, &cap, count, sizeof(int)) != 0) {
+			free(reader);
+			free(*pids);
+			*pids = NULL;
+			errno = ENOMEM;
+			return -1;
+		}
+		(*pids)[count ++] = pid;
+	}
+	free(reader);
+	stats_phase(options -> stats, FDT_PHASE_ENUMERATE, start);
+	return count;
+}
+
+/** @brief Loop the /proc directory to find processes accepted by the process filter.
+ * 
+ * 	The function opens the /proc directory and reads each directory in the directory.
+ *  If a directory name is a number (represents a PID), the function checks whether
+ *  the process passes the filter (by default: the process owner is the current
+ *  user). If it does, the function calls the show_FD function on that process ID,
+ *  to capture its FD table into the snapshot. With more than one job the PIDs are
+ *  spread across worker threads.
+ * 
+ *  @param snap - A pointer to the snapshot to fill.
+ *  @param options - A pointer to the scanner options (options -> jobs worker
+ * 				     threads scan the PIDs).
+ *  @return 0 on success, -1 if the proc root cannot be opened or the scan runs
+ * 			out of memory (errno is set).
+ */
+static int find_files(fdt_snapshot *snap, const fdt_options *options) {
+	int *pids;                     // The PIDs found in /proc
+	int jobs = options -> jobs;
+	int ret = 0;
+
+    // Open the /proc directory. If fails, report the error
+    int proc_fd = open_proc_root(options);
+    if (proc_fd == -1) {
+        return -1;
+    }
+    ssize_t count = list_pids(proc_fd, options, &pids);
+    if (count == -1) {
+    	close(proc_fd);
+    	return -1;
+    }
+
+    uint64_t start = stats_clock(options -> stats);
+    if (jobs > 1 && count > 1) {
+    	ret = parallel_scan(snap, proc_fd, pids, count, options, jobs < count ? jobs : count);
+    } else {
+    	for (ssize_t i = 0; ret == 0 && i < count; i ++) {
+    		ret = scan_process(proc_fd, pids[i], options, snap);
+    	}
+    }
+    stats_phase(options -> stats, FDT_PHASE_SCAN, start);
+    // Close the dictionary
+    close(proc_fd);
+    free(pids);
+    if (ret != 0) {
+    	errno = ENOMEM;
+    }
+    return ret;
+}
+
+/** @brief One slot of the ring buffer of a streaming scan.
+ *
+ *  The sequence number tells who owns the slot: a scanner may fill it for
+ *  PID index k once it equals k, and the writer may drain it once it equals
+ *  k + 1. Draining sets it to k + the ring size, handing it to the scanner of
+ *  the PID one lap later.
+ */
+typedef struct {
+	uint64_t seq;          // The sequence number (accessed atomically)
+	fdt_snapshot batch;     // The records of one process, reused lap after lap
+} stream_slot;
+
+/** @brief State shared by the scanner and writer threads of a streaming scan.
+ */
+typedef struct {
+	int *pids;             // The PIDs to scan, in /proc order
+	size_t count;          // The number of PIDs
+	int proc_fd;           // A file descriptor of the /proc directory
+	const fdt_options *options; // The scanner options
+	size_t next;           // The next PID index to claim (accessed atomically)
+	stream_slot *ring;     // The ring buffer
+	size_t mask;           // The ring size minus one (the size is a power of two)
+	fdt_batch_callback callback; // Called by the writer for each process
+	void *arg;             // Passed to the callback
+	int stop;              // The value the callback stopped the stream with (atomic)
+	int error;             // The errno value of the first failed scan, or 0 (atomic)
+} stream_pipe;
+
+/** @brief Wait until a sequence number reaches a value.
+ *
+ *  The wait spins briefly, then yields, then sleeps, so that a stage blocked
+ *  on a slow peer (a full ring or an empty one) does not burn a CPU.
+ *
+ *  @param seq - A pointer to the sequence number.
+ *  @param value - The value to wait for.
+ *  @return Void.
+ */
+static void stream_wait(const uint64_t *seq, uint64_t value) {
+	struct timespec nap = {0, 50000};
+	for (int round = 0; __atomic_load_n(seq, __ATOMIC_ACQUIRE) != value; round ++) {
+		if (round >= 128) {
+			nanosleep(&nap, NULL);
+		} else if (round >= 64) {
+			sched_yield();
+		}
+	}
+}
+
+/** @brief The body of a scanner thread of a streaming scan.
+ *
+ *  PID indices are claimed in order, and each process is captured straight
+ *  into its ring slot once the writer has drained the slot's previous lap. A
+ *  scan that runs out of memory stops the stream, like the callback does.
+ *
+ *  @param arg - A pointer to the stream_pipe.
+ *  @return NULL.
+ */
+static void *stream_scanner(void *arg) {
+	stream_pipe *stream = arg;
+	size_t k;
+	while ((k = __atomic_fetch_add(&stream -> next, 1, __ATOMIC_RELAXED)) < stream -> count) {
+		stream_slot *slot = &stream -> ring[k & stream -> mask];
+		stream_wait(&slot -> seq, k);
+		clear_snapshot(&slot -> batch);
+		if (__atomic_load_n(&stream -> stop, __ATOMIC_RELAXED) == 0 &&
+			scan_process(stream -> proc_fd, stream -> pids[k], stream -> options,
+			&slot -> batch) != 0) {
+			int none = 0;
+			__atomic_compare_exchange_n(&stream -> error, &none, errno, 0, __ATOMIC_RELAXED,
+				__ATOMIC_RELAXED);
+			__atomic_store_n(&stream -> stop, -1, __ATOMIC_RELAXED);
+			clear_snapshot(&slot -> batch);
+		}
+		__atomic_store_n(&slot -> seq, k + 1, __ATOMIC_RELEASE);
+	}
+	return NULL;
+}
+
+/** @brief The body of the writer thread of a streaming scan.
+ *
+ *  The slots are drained in PID order, so the callback sees the processes in
+ *  the same order as a single-threaded scan. Once the callback stops the
+ *  stream, the remaining slots are drained without calling it.
+ *
+ *  @param arg - A pointer to the stream_pipe.
+ *  @return NULL.
+ */
+static void *stream_writer(void *arg) {
+	stream_pipe *stream = arg;
+	for (size_t k = 0; k < stream -> count; k ++) {
+		stream_slot *slot = &stream -> ring[k & stream -> mask];
+		stream_wait(&slot -> seq, k + 1);
+		if (__atomic_load_n(&stream -> stop, __ATOMIC_RELAXED) == 0 &&
+			slot -> batch.proc_count > 0) {
+			int stop = stream -> callback(&slot -> batch, stream -> arg);
+			if (stop != 0) {
+				__atomic_store_n(&stream -> stop, stop, __ATOMIC_RELAXED);
+			}
+		}
+		__atomic_store_n(&slot -> seq, k + stream -> mask + 1, __ATOMIC_RELEASE);
+	}
+	return NULL;
+}
+
+/** @brief Run the writer thread and the scanner threads of a streaming scan
+ *  until every PID has been passed.
+ *
+ *  @param stream - A pointer to the stream_pipe, with its ring set up.
+ *  @param threads - An array of jobs thread handles.
+ *  @param jobs - The number of scanner threads.
+ *  @return 0 on success, or an errno value if the writer thread cannot be started.
+ */
+static int stream_run(stream_pipe *stream, pthread_t *threads, int jobs) {
+	pthread_t writer;
+	int err = pthread_create(&writer, NULL, stream_writer, stream);
+	if (err != 0) {
+		return err;
+	}
+	int started = 0;
+	for (; started < jobs; started ++) {
+		if (pthread_create(&threads[started], NULL, stream_scanner, stream) != 0) {
+			break;
+		}
+	}
+	// If no scanner thread could be started, scan on this thread
+	if (started == 0) {
+		stream_scanner(stream);
+	}
+	for (int i = 0; i < started; i ++) {
+		pthread_join(threads[i], NULL);
+	}
+	pthread_join(writer, NULL);
+	return 0;
+}
+
+/** @brief Scan /proc and pass the processes to a writer thread as they are captured.
+ *
+ *  Scanner threads capture the processes accepted by the filter into a
+ *  bounded ring buffer of per-process batches, and a dedicated writer thread
+ *  passes the batches to the callback in /proc order. The ring is lock-free:
+ *  each slot is handed back and forth with its sequence number. When the ring
+ *  is full the scanners wait for the writer (backpressure), so at most queue
+ *  processes are held in memory, whatever the total number of FDs; the
+ *  batches keep their storage from one lap to the next.
+ *
+ *  @param options - A pointer to the scanner options (options -> jobs scanner
+ * 				     threads capture the processes).
+ *  @param queue - The number of batches the ring holds (rounded up to a power of
+ * 				two, at least 2).
+ *  @param callback - The function called by the writer thread for each process.
+ *  @param arg - Passed to the callback.
+ *  @param uring_failed - The io_uring fallback flag of the scanner, or NULL.
+ *  @return The nonzero value the callback stopped the stream with, 0 if every
+ * 			process was passed, or -1 if the proc root cannot be opened, the
+ * 			scan runs out of memory or the writer thread cannot be started
+ * 			(errno is set).
+ */
+static int stream_scan(const fdt_options *options, size_t queue, fdt_batch_callback callback,
+	void *arg, int *uring_failed) {
+	stream_pipe stream = {NULL, 0, -1, options, 0, NULL, 0, callback, arg, 0, 0};
+	int err;
+
+	if ((stream.proc_fd = open_proc_root(options)) == -1) {
+		return -1;
+	}
+	ssize_t count = list_pids(stream.proc_fd, options, &stream.pids);
+	if (count == -1) {
+		close(stream.proc_fd);
+		return -1;
+	}
+	stream.count = count;
+
+	// A ring of one slot could not tell a filled slot from a drained one
+	size_t size = 2;
+	while (size < queue) {
+		size *= 2;
+	}
+	stream.mask = size - 1;
+	pthread_t *threads = calloc(options -> jobs, sizeof(pthread_t));
+	if ((stream.ring = calloc(size, sizeof(stream_slot))) == NULL || threads == NULL) {
+		err = ENOMEM;
+	} else {
+		for (size_t i = 0; i < size; i ++) {
+			stream.ring[i].seq = i;
+			stream.ring[i].batch.uring_failed = uring_failed;
+		}
+		uint64_t start = stats_clock(options -> stats);
+		err = stream_run(&stream, threads, options -> jobs);
+		stats_phase(options -> stats, FDT_PHASE_SCAN, start);
+	}
+
+	for (size_t i = 0; stream.ring != NULL && i < size; i ++) {
+		free_snapshot(&stream.ring[i].batch);
+	}
+	free(stream.ring);
+	free(threads);
+	free(stream.pids);
+	close(stream.proc_fd);
+	// A scanner that ran out of memory stopped the stream
+	if (err == 0) {
+		err = stream.error;
+	}
+	if (err != 0) {
+		errno = err;
+		return -1;
+	}
+	return stream.stop;
+}
+
+/** @brief Count the entries of a process' fd directory without stat or readlink.
+ *
+ *  @param pid_dir - A file descriptor of the /proc/[PID] directory.
+ *  @param reader - A reader whose buffer is reused for the enumeration.
+ *  @param stats - The instrumentation of the scan, or NULL.
+ *  @return The number of file descriptors, or -1 if the directory cannot be read.
+ */
+static int count_FD(int pid_dir, dent_reader *reader, fdt_stats *stats) {
+	int fd_num = 0;
+	reader -> fd = openat(pid_dir, "fd", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (reader -> fd == -1) {
+		stats_lost_process(stats, errno);
+		return -1;
+	}
+	reader -> len = reader -> pos = 0;
+	while (next_dent(reader) != NULL) {
+		fd_num ++;
+	}
+	close(reader -> fd);
+	STATS_ADD(stats, procs_scanned, 1);
+	STATS_ADD(stats, fds_seen, fd_num);
+	return fd_num;
+}
+
+/** @brief Count the file descriptors of every process accepted by the process filter.
+ *
+ *  This is the fast path of the threshold report: only the fd directories are
+ *  enumerated, nothing is stat'ed or readlink'ed.
+ *
+ *  @param counts - A pointer to store the allocated array of counts (in /proc order).
+ *  @param options - A pointer to the scanner options (the filter, proc root and stats).
+ *  @param starttimes - 1 to also read the start time of each process (so a
+ * 					    reused PID can be told apart), 0 to leave it 0.
+ *  @return The number of counted processes, or -1 if the proc root cannot be
+ * 			opened or the counts do not fit in memory (errno is set and *counts
+ * 			is NULL).
+ */
+ssize_t count_files(fd_count **counts, const fdt_options *options, int starttimes) {
+	int pid;                       // The current PID
+	dent_reader *procs, *fds;      // Batched readers of /proc and of an fd directory
+	size_t count = 0, cap = 0;     // Number of counts and capacity of counts
+	size_t index = 0;              // The position in the PID set
+	int ret = 0;
+
+	*counts = NULL;
+	int proc_fd = open_proc_root(options);
+	if (proc_fd == -1) {
+		return -1;
+	}
+	procs = malloc(sizeof(dent_reader));
+	fds = malloc(sizeof(dent_reader));
+	if (procs == NULL || fds == NULL) {
+		free(procs);
+		free(fds);
+		close(proc_fd);
+		errno = ENOMEM;
+		return -1;
+	}
+	procs -> fd = proc_fd;
+	procs -> len = procs -> pos = 0;
+
+	// Enumeration and counting are interleaved, so both are timed as the scan
+	uint64_t start = stats_clock(options -> stats);
+	while (ret == 0 && (pid = next_pid(procs, options, &index)) != -1) {
+		if (!filter_process(options, proc_fd, pid)) {
+			continue;
+		}
+		int pid_dir = open_pid_dir(proc_fd, pid, options);
+		if (pid_dir == -1) {
+			continue;
+		}
+		int fd_num = count_FD(pid_dir, fds, options -> stats);
+		uint64_t starttime = starttimes && fd_num != -1 ? read_starttime(pid_dir) : 0;
+		close(pid_dir);
+		if (fd_num == -1) {
+			continue;
+		}
+		if ((ret = grow_array((void **) counts, &cap, count, sizeof(fd_count))) == 0) {
+			(*counts)[count].pid = pid;
+			(*counts)[count].starttime = starttime;
+			(*counts)[count ++].fd_num = fd_num;
+		}
+	}
+	stats_phase(options -> stats, FDT_PHASE_SCAN, start);
+
+	free(fds);
+	free(procs);
+	close(proc_fd);
+	if (ret != 0) {
+		free(*counts);
+		*counts = NULL;
+		errno = ENOMEM;
+		return -1;
+	}
+	return count;
+}
+
+/** @brief Build the snapshot that the tables and the file exports are rendered from.
+ *
+ *  /proc is scanned only once: either all processes accepted by the process filter
+ *  are scanned (if no PID is given), or only the given PID.
+ *
+ *  @param snap - A pointer to an empty snapshot to fill.
+ *  @param pid - The target process ID, or -1 for all filtered processes.
+ *  @param options - A pointer to the scanner options.
+ *  @return 0 on success, -1 if the proc root cannot be opened or the scan runs
+ * 			out of memory (errno is set).
+ */
+static int build_snapshot(fdt_snapshot *snap, int pid, const fdt_options *options) {
+	if (pid == -1) {
+		return find_files(snap, options);
+	}
+	int ret = 0;
+	uint64_t start = stats_clock(options -> stats);
+	STATS_ADD(options -> stats, procs_visited, 1);
+	int pid_dir = open_pid_dir(-1, pid, options);
+	if (pid_dir != -1) {
+		ret = show_FD(pid, pid_dir, options, snap);
+		if (ret == 0 && options -> filter.tasks) {
+			ret = scan_tasks(pid, pid_dir, options, snap);
+		}
+		close(pid_dir);
+	}
+	stats_phase(options -> stats, FDT_PHASE_SCAN, start);
+	if (ret != 0) {
+		errno = ENOMEM;
+	}
+	return ret;
+}
+
+/** @brief Read the start time of a process from /proc/[PID]/stat.
+ *
+ *  Together with the PID, the start time identifies a process even if the PID
+ *  is reused.
+ *
+ *  @param pid_dir - A file descriptor of the /proc/[PID] directory.
+ *  @return The start time (in clock ticks after boot), or 0 on error.
+ */
+uint64_t read_starttime(int pid_dir) {
+	char buf[1024];    // The content of "/proc/[PID]/stat"
+	int fd = openat(pid_dir, "stat", O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		return 0;
+	}
+	ssize_t len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len <= 0) {
+		return 0;
+	}
+	buf[len] = '\0';
+
+	// The command name may contain spaces, so count fields after its closing
+	// parenthesis: the state is field 3 and the start time is field 22
+	char *p = strrchr(buf, ')');
+	for (int field = 2; p != NULL && field < 22; field ++) {
+		p = strchr(p + 1, ' ');
+	}
+	return p != NULL ? strtoull(p + 1, NULL, 10) : 0;
+}
+
+/** @brief Hash an inode number (the finalizer of MurmurHash3).
+ *
+ *  @param inode - The inode number.
+ *  @return The hash value.
+ */
+uint64_t hash_inode(uint64_t inode) {
+	inode ^= inode >> 33;
+	inode *= 0xff51afd7ed558ccdULL;
+	inode ^= inode >> 33;
+	inode *= 0xc4ceb9fe1a85ec53ULL;
+	return inode ^ (inode >> 33);
+}
+
+/** @brief Find the slot of a socket in the index, or the empty slot it belongs in.
+ *
+ *  @param index - A pointer to the index.
+ *  @param inode - The inode number of the socket.
+ *  @return A pointer to the slot.
+ */
+static socket_entry *find_socket_slot(socket_index *index, uint64_t inode) {
+	size_t i = hash_inode(inode) & (index -> cap - 1);
+	while (index -> slots[i].inode != 0 && index -> slots[i].inode != inode) {
+		i = (i + 1) & (index -> cap - 1);
+	}
+	return &index -> slots[i];
+}
+
+/** @brief Add a socket to the index, doubling the table at a load factor of one half.
+ *
+ *  @param index - A pointer to the index.
+ *  @param entry - The socket to add (its inode must not be 0).
+ *  @return 0 on success, -1 if out of memory (errno is set).
+ */
+static int add_socket(socket_index *index, const socket_entry *entry) {
+	if (2 * (index -> count + 1) > index -> cap) {
+		socket_index grown = {NULL, index -> cap ? 2 * index -> cap : 1024, 0,
+			index -> paths, index -> paths_size, index -> paths_cap};
+		if ((grown.slots = calloc(grown.cap, sizeof(socket_entry))) == NULL) {
+			errno = ENOMEM;
+			return -1;
+		}
+		for (size_t i = 0; i < index -> cap; i ++) {
+			if (index -> slots[i].inode != 0) {
+				*find_socket_slot(&grown, index -> slots[i].inode) = index -> slots[i];
+				grown.count ++;
+			}
+		}
+		free(index -> slots);
+		*index = grown;
+	}
+	socket_entry *slot = find_socket_slot(index, entry -> inode);
+	index -> count += slot -> inode == 0;
+	*slot = *entry;
+	return 0;
+}
+
+/** @brief Parse an address of /proc/net/{tcp,udp}[6] ("0100007F:0016").
+ *
+ *  The kernel prints the address as 32-bit words in host byte order, so each
+ *  word is copied back as is to recover the bytes in network order.
+ *
+ *  @param text - The address text.
+ *  @param addr - The 16 bytes to store the address in.
+ *  @param port - A pointer to store the port in.
+ *  @return A pointer past the parsed text, or NULL if it is malformed.
+ */
+static const char *parse_inet_address(const char *text, unsigned char *addr, uint16_t *port) {
+	int words = 0;
+	char *end;
+	while (isxdigit((unsigned char) *text) && words < 4) {
+		char word[9] = {0};
+		memcpy(word, text, 8);
+		uint32_t value = strtoul(word, &end, 16);
+		if (end != word + 8) {
+			return NULL;
+		}
+		memcpy(addr + 4 * words ++, &value, 4);
+		text += 8;
+	}
+	if (*text != ':' || (words != 1 && words != 4)) {
+		return NULL;
+	}
+	*port = strtoul(text + 1, &end, 16);
+	return end;
+}
+
+/** @brief Read the TCP or UDP sockets of one /proc/net table into the index.
+ *
+ *  @param index - A pointer to the index.
+ *  @param name - The table name (e.g. "tcp6").
+ *  @param proto - The protocol of the table (SOCKET_TCP or SOCKET_UDP).
+ *  @param family - The address family of the table (AF_INET or AF_INET6).
+ *  @param options - A pointer to the scanner options (the proc root).
+ *  @return 0 on success (also if the table is missing), -1 if out of memory.
+ */
+static int read_inet_sockets(socket_index *index, const char *name, int proto, int family,
+	const fdt_options *options) {
+	char path[PATH_MAX];
+	char *line = NULL;
+	size_t size = 0;
+	int ret = 0;
+
+	snprintf(path, sizeof(path), "%s/net/%s", options -> proc_root, name);
+	FILE *table = fopen(path, "r");
+	if (table == NULL) {
+		return 0;
+	}
+	// The first line is the header:
+	// "sl local_address rem_address st tx_queue:rx_queue tr:tm->when retrnsmt uid timeout inode"
+	while (ret == 0 && getline(&line, &size, table) > 0) {
+		socket_entry entry = {0};
+		unsigned long long inode;
+		unsigned int state;
+		const char *p = strchr(line, ':');
+		if (p == NULL || (p = parse_inet_address(p + 2, entry.local, &entry.local_port)) == NULL ||
+			(p = parse_inet_address(p + 1, entry.remote, &entry.remote_port)) == NULL ||
+			sscanf(p, "%x %*s %*s %*s %*s %*s %llu", &state, &inode) != 2 || inode == 0) {
+			continue;
+		}
+		entry.inode = inode;
+		entry.proto = proto;
+		entry.family = family;
+		entry.state = state;
+		ret = add_socket(index, &entry);
+	}
+	free(line);
+	fclose(table);
+	if (ret != 0) {
+		errno = ENOMEM;
+	}
+	return ret;
+}
+
+/** @brief Read the Unix domain sockets of /proc/net/unix into the index.
+ *
+ *  @param index - A pointer to the index.
+ *  @param options - A pointer to the scanner options (the proc root).
+ *  @return 0 on success (also if the table is missing), -1 if out of memory.
+ */
+static int read_unix_sockets(socket_index *index, const fdt_options *options) {
+	char path[PATH_MAX];
+	char *line = NULL;
+	size_t size = 0;
+	int ret = 0;
+
+	snprintf(path, sizeof(path), "%s/net/unix", options -> proc_root);
+	FILE *table = fopen(path, "r");
+	if (table == NULL) {
+		return 0;
+	}
+	// "Num RefCount Protocol Flags Type St Inode Path"
+	while (ret == 0 && getline(&line, &size, table) > 0) {
+		socket_entry entry = {0};
+		unsigned long long inode;
+		unsigned int flags, type, state;
+		int end = 0;
+		if (sscanf(line, "%*x: %*x %*x %x %x %x %llu %n", &flags, &type, &state, &inode,
+			&end) != 4 || inode == 0) {
+			continue;
+		}
+		entry.inode = inode;
+		entry.proto = SOCKET_UNIX;
+		entry.family = AF_UNIX;
+		entry.state = flags & 0x10000 ? SOCKET_LISTENING : state;
+		entry.unix_type = type;
+
+		// Keep the bound path, if any, in the path pool
+		size_t len = strcspn(line + end, "\n");
+		if (len > 0) {
+			size_t cap = index -> paths_cap;
+			while (index -> paths_size + len + 1 > cap) {
+				cap = cap ? 2 * cap : 4096;
+			}
+			char *paths = cap != index -> paths_cap ? realloc(index -> paths, cap) : index -> paths;
+			if (paths == NULL) {
+				ret = -1;
+				break;
+			}
+			index -> paths = paths;
+			index -> paths_cap = cap;
+			entry.path = index -> paths_size + 1;
+			memcpy(index -> paths + index -> paths_size, line + end, len);
+			index -> paths[index -> paths_size + len] = '\0';
+			index -> paths_size += len + 1;
+		}
+		ret = add_socket(index, &entry);
+	}
+	free(line);
+	fclose(table);
+	if (ret != 0) {
+		errno = ENOMEM;
+	}
+	return ret;
+}
+
+/** @brief Parse the socket tables of /proc/net into an index keyed by inode.
+ *
+ *  Each table is read once, so looking up a socket FD afterwards costs one hash
+ *  probe. The tables describe the network namespace of this program.
+ *
+ *  @param index - A pointer to the index to fill (freed with free_socket_index,
+ * 				   even on failure).
+ *  @param options - A pointer to the scanner options (the proc root).
+ *  @return 0 on success, -1 if out of memory (errno is set).
+ */
+int build_socket_index(socket_index *index, const fdt_options *options) {
+	memset(index, 0, sizeof(*index));
+	if (read_inet_sockets(index, "tcp", SOCKET_TCP, AF_INET, options) != 0 ||
+		read_inet_sockets(index, "tcp6", SOCKET_TCP, AF_INET6, options) != 0 ||
+		read_inet_sockets(index, "udp", SOCKET_UDP, AF_INET, options) != 0 ||
+		read_inet_sockets(index, "udp6", SOCKET_UDP, AF_INET6, options) != 0 ||
+		read_unix_sockets(index, options) != 0) {
+		return -1;
+	}
+	return 0;
+}
+
+/** @brief Look up a socket by inode.
+ *
+ *  @param index - A pointer to the index.
+ *  @param inode - The inode number of the socket.
+ *  @return A pointer to the socket, or NULL if it is in none of the tables.
+ */
+const socket_entry *find_socket(socket_index *index, uint64_t inode) {
+	if (index -> cap == 0 || inode == 0) {
+		return NULL;
+	}
+	socket_entry *slot = find_socket_slot(index, inode);
+	return slot -> inode != 0 ? slot : NULL;
+}
+
+/** @brief Release the memory held by a socket index.
+ *
+ *  @param index - A pointer to the index.
+ *  @return Void.
+ */
+void free_socket_index(socket_index *index) {
+	free(index -> slots);
+	free(index -> paths);
+	memset(index, 0, sizeof(*index));
+}
+
+/** @brief Format an address and port of an internet socket ("[::1]:80").
+ */
+static void format_address(char *buf, size_t size, int family, const unsigned char *addr,
+	uint16_t port) {
+	char host[INET6_ADDRSTRLEN];
+	inet_ntop(family, addr, host, sizeof(host));
+	snprintf(buf, size, family == AF_INET6 ? "[%s]:%u" : "%s:%u", host, port);
+}
+
+/** @brief Describe a socket: protocol, addresses and state.
+ *
+ *  For example "tcp 127.0.0.1:5432 -> 127.0.0.1:40000 ESTABLISHED",
+ *  "udp 0.0.0.0:68" or "unix STREAM /run/app.sock LISTEN".
+ *
+ *  @param index - A pointer to the index the socket was found in.
+ *  @param entry - A pointer to the socket.
+ *  @param buf - The buffer to write the description to.
+ *  @param size - The size of buf.
+ *  @return Void.
+ */
+void format_socket(const socket_index *index, const socket_entry *entry, char *buf,
+	size_t size) {
+	static const char *tcp_states[] = {"", "ESTABLISHED", "SYN_SENT", "SYN_RECV",
+		"FIN_WAIT1", "FIN_WAIT2", "TIME_WAIT", "CLOSE", "CLOSE_WAIT", "LAST_ACK",
+		"LISTEN", "CLOSING", "NEW_SYN_RECV"};
+	static const char *unix_states[] = {"", "UNCONNECTED", "CONNECTING", "CONNECTED",
+		"DISCONNECTING"};
+	char local[64], remote[64];
+
+	if (entry -> proto == SOCKET_UNIX) {
+		const char *type = entry -> unix_type == 1 ? "STREAM" : entry -> unix_type == 2
+			? "DGRAM" : entry -> unix_type == 5 ? "SEQPACKET" : "?";
+		const char *state = entry -> state == SOCKET_LISTENING ? "LISTEN"
+			: entry -> state < 5 ? unix_states[entry -> state] : "?";
+		snprintf(buf, size, "unix %s%s%s %s", type, entry -> path ? " " : "",
+			entry -> path ? index -> paths + entry -> path - 1 : "", state);
+		return;
+	}
+
+	format_address(local, sizeof(local), entry -> family, entry -> local, entry -> local_port);
+	format_address(remote, sizeof(remote), entry -> family, entry -> remote,
+		entry -> remote_port);
+	if (entry -> proto == SOCKET_UDP) {
+		// An unconnected UDP socket has no peer
+		if (entry -> state == 1) {
+			snprintf(buf, size, "udp %s -> %s", local, remote);
+		} else {
+			snprintf(buf, size, "udp %s", local);
+		}
+	} else if (entry -> state == 10) {
+		snprintf(buf, size, "tcp %s LISTEN", local);
+	} else {
+		snprintf(buf, size, "tcp %s -> %s %s", local, remote,
+			entry -> state < 13 ? tcp_states[entry -> state] : "?");
+	}
+}
+
+/** @brief A scanner: its options and the buffers it reuses between scans.
+ */
+struct fdt_scanner {
+	fdt_options options;   // A copy of the options given to fdt_open
+	int uring_failed;      // Set once io_uring turns out to be unusable (atomic)
+	fdt_snapshot snap;      // The records of the last scan
+	dent_reader *reader;   // The reader of /proc used by fdt_foreach
+	fdt_record row;         // The row returned by fdt_next
+};
+
+/** @brief Fill scanner options with the defaults of showFDtables.
+ *
+ *  The defaults scan the processes of the current user in /proc, fetch every
+ *  field with one synchronous stat per FD, use one thread per online CPU and
+ *  collect no instrumentation.
+ *
+ *  @param options - A pointer to the options to fill.
+ *  @return Void.
+ */
+void fdt_default_options(fdt_options *options) {
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	memset(options, 0, sizeof(*options));
+	options -> filter.uid = getuid();
+	options -> filter.pid_max = -1;
+	options -> fields = FDT_FIELDS_ALL;
+	options -> jobs = cpus > 0 ? cpus : 1;
+	options -> proc_root = "/proc";
+	options -> io = FDT_IO_SYNC;
+	options -> io_batch = FDT_IO_BATCH;
+}
+
+/** @brief Create a scanner.
+ *
+ *  Out-of-range settings are clamped: at least one job, a batch of 1 to
+ *  FDT_IO_BATCH_MAX calls, and /proc if no proc root is given.
+ *
+ *  @param options - A pointer to the options (copied into the scanner; the
+ * 				     proc root and the stats must outlive the scanner).
+ *  @return A pointer to the scanner, or NULL if out of memory (errno is set).
+ */
+fdt_scanner *fdt_open(const fdt_options *options) {
+	fdt_scanner *scanner = calloc(1, sizeof(fdt_scanner));
+	if (scanner == NULL || (scanner -> reader = malloc(sizeof(dent_reader))) == NULL) {
+		free(scanner);
+		errno = ENOMEM;
+		return NULL;
+	}
+	scanner -> options = *options;
+	if (scanner -> options.jobs < 1) {
+		scanner -> options.jobs = 1;
+	}
+	if (scanner -> options.io_batch < 1) {
+		scanner -> options.io_batch = 1;
+	} else if (scanner -> options.io_batch > FDT_IO_BATCH_MAX) {
+		scanner -> options.io_batch = FDT_IO_BATCH_MAX;
+	}
+	if (scanner -> options.proc_root == NULL) {
+		scanner -> options.proc_root = "/proc";
+	}
+	scanner -> snap.uring_failed = &scanner -> uring_failed;
+	return scanner;
+}
+
+/** @brief Scan /proc into the scanner's snapshot, replacing the previous scan.
+ *
+ *  The columns and string arena of the previous scan are reused, so a scanner
+ *  that is kept between intervals does not reallocate them.
+ *
+ *  @param scanner - A pointer to the scanner.
+ *  @param pid - The process ID to scan (regardless of the filter), or -1 for
+ * 				 every process accepted by the filter.
+ *  @return The number of captured records, or -1 if the proc root cannot be
+ * 			opened or the scan runs out of memory (errno is set; the snapshot
+ * 			keeps the records captured before the failure).
+ */
+ssize_t fdt_scan(fdt_scanner *scanner, int pid) {
+	clear_snapshot(&scanner -> snap);
+	if (build_snapshot(&scanner -> snap, pid, &scanner -> options) != 0) {
+		return -1;
+	}
+	return scanner -> snap.fd_count;
+}
+
+/** @brief Iterate over the records of the last fdt_scan.
+ *
+ *  Records are returned in /proc order, grouped by process. Nothing is
+ *  allocated: the returned row is overwritten by the next call, and its
+ *  strings stay valid until the next scan.
+ *
+ *  @param scanner - A pointer to the scanner.
+ *  @param cursor - A pointer to the iteration state, set to 0 before the first call.
+ *  @return A pointer to the next record, or NULL after the last one.
+ */
+const fdt_record *fdt_next(fdt_scanner *scanner, size_t *cursor) {
+	if (*cursor >= scanner -> snap.fd_count) {
+		return NULL;
+	}
+	fdt_get_record(&scanner -> snap, (*cursor) ++, &scanner -> row);
+	return &scanner -> row;
+}
+
+/** @brief Stream the records of a scan to a callback, one process at a time.
+ *
+ *  Unlike fdt_scan, only the records of the current process are held in
+ *  memory, and the scanner's buffers are reused from one process to the next.
+ *  The scan runs on the calling thread, so the callback needs no locking.
+ *  The scanner's snapshot is left empty.
+ *
+ *  @param scanner - A pointer to the scanner.
+ *  @param pid - The process ID to scan (regardless of the filter), or -1 for
+ * 				 every process accepted by the filter.
+ *  @param callback - The function called for each record.
+ *  @param arg - Passed to the callback.
+ *  @return The nonzero value the callback stopped the scan with, 0 if every
+ * 			record was passed, or -1 if the proc root cannot be opened or the
+ * 			scan runs out of memory (errno is set).
+ */
+int fdt_foreach(fdt_scanner *scanner, int pid, fdt_callback callback, void *arg) {
+	const fdt_options *options = &scanner -> options;
+	fdt_snapshot *snap = &scanner -> snap;
+	dent_reader *reader = scanner -> reader;
+	size_t index = 0;      // The position in the PID set
+	int proc_pid;          // The PID being scanned
+	fdt_record rec;
+	int stop = 0;
+
+	if (pid != -1) {
+		clear_snapshot(snap);
+		if (build_snapshot(snap, pid, options) != 0) {
+			clear_snapshot(snap);
+			return -1;
+		}
+		for (size_t i = 0; stop == 0 && i < snap -> fd_count; i ++) {
+			fdt_get_record(snap, i, &rec);
+			stop = callback(&rec, arg);
+		}
+		clear_snapshot(snap);
+		return stop;
+	}
+
+	if ((reader -> fd = open_proc_root(options)) == -1) {
+		return -1;
+	}
+	reader -> len = reader -> pos = 0;
+	while (stop == 0 && (proc_pid = next_pid(reader, options, &index)) != -1) {
+		clear_snapshot(snap);
+		if (scan_process(reader -> fd, proc_pid, options, snap) != 0) {
+			clear_snapshot(snap);
+			close(reader -> fd);
+			errno = ENOMEM;
+			return -1;
+		}
+		for (size_t i = 0; stop == 0 && i < snap -> fd_count; i ++) {
+			fdt_get_record(snap, i, &rec);
+			stop = callback(&rec, arg);
+		}
+	}
+	clear_snapshot(snap);
+	close(reader -> fd);
+	return stop;
+}
+
+/** @brief Stream the records of a scan to a writer thread, one process at a time.
+ *
+ *  The scan runs on the scanner's threads while a dedicated writer thread
+ *  calls the callback (see stream_scan), so output I/O in the callback
+ *  overlaps with the /proc reads. At most queue processes are held in memory.
+ *  The scanner's snapshot is left empty.
+ *
+ *  @param scanner - A pointer to the scanner.
+ *  @param pid - The process ID to scan (regardless of the filter), or -1 for
+ * 				 every process accepted by the filter.
+ *  @param queue - The number of processes the queue between the stages holds.
+ *  @param callback - The function called (on the writer thread) for each process.
+ *  @param arg - Passed to the callback.
+ *  @return The nonzero value the callback stopped the stream with, 0 if every
+ * 			process was passed, or -1 if the proc root cannot be opened, the
+ * 			scan runs out of memory or the writer thread cannot be started
+ * 			(errno is set).
+ */
+int fdt_stream(fdt_scanner *scanner, int pid, size_t queue, fdt_batch_callback callback,
+	void *arg) {
+	const fdt_options *options = &scanner -> options;
+	clear_snapshot(&scanner -> snap);
+	if (pid == -1) {
+		return stream_scan(options, queue > 0 ? queue : 1, callback, arg,
+			&scanner -> uring_failed);
+	}
+
+	// A single process needs no pipeline
+	int stop = 0;
+	if (build_snapshot(&scanner -> snap, pid, options) != 0) {
+		clear_snapshot(&scanner -> snap);
+		return -1;
+	}
+	if (scanner -> snap.proc_count > 0) {
+		stop = callback(&scanner -> snap, arg);
+	}
+	clear_snapshot(&scanner -> snap);
+	return stop;
+}
+
+/** @brief Access the snapshot of the last fdt_scan.
+ *
+ *  The snapshot is owned by the scanner: it may be read and modified, but it is
+ *  freed by fdt_close and cleared by the next scan.
+ *
+ *  @param scanner - A pointer to the scanner.
+ *  @return A pointer to the scanner's snapshot.
+ */
+fdt_snapshot *fdt_get_snapshot(fdt_scanner *scanner) {
+	return &scanner -> snap;
+}
+
+/** @brief Count the records of a snapshot (read them with fdt_get_record).
+ *
+ *  @param snap - A pointer to the snapshot.
+ *  @return The number of records.
+ */
+size_t fdt_snapshot_size(const fdt_snapshot *snap) {
+	return snap -> fd_count;
+}
+
+/** @brief Free a scanner and its snapshot.
+ *
+ *  @param scanner - A pointer to the scanner (may be NULL).
+ *  @return Void.
+ */
+void fdt_close(fdt_scanner *scanner) {
+	if (scanner != NULL) {
+		free_snapshot(&scanner -> snap);
+		free(scanner -> reader);
+		free(scanner);
+	}
+}
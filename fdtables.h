@@ -0,0 +1,169 @@
+/** @file fdtables.h
+ *  @brief The FD table scanner library (libfdtables)
+ *
+ *  The library walks /proc and captures the file descriptor tables of the
+ *  processes accepted by a process filter. A program can scan in-process
+ *  through an opaque scanner handle, which keeps its buffers between scans,
+ *  and read the records with an iterator or a callback. Every setting of a
+ *  scan (the filter, the fields, the threads, the proc root, the I/O backend
+ *  and the instrumentation) is carried by fdt_options, and every function
+ *  reports failures through its return value and errno: the library never
+ *  prints and never exits. showFDtables is a client of this library.
+ *
+ *  A minimal client:
+ *
+ *      fdt_options options;
+ *      fdt_default_options(&options);
+ *      fdt_scanner *scanner = fdt_open(&options);
+ *      size_t cursor = 0;
+ *      const fdt_record *rec;
+ *      if (fdt_scan(scanner, -1) == -1) {
+ *          perror("fdt_scan");
+ *      }
+ *      while ((rec = fdt_next(scanner, &cursor)) != NULL) {
+ *          printf("%d %d %s\n", rec -> pid, rec -> fd, rec -> link);
+ *      }
+ *      fdt_close(scanner);
+ *
+ *  @author Huang Xinzi
+ *  @bug No known bugs.
+ */
+
+#ifndef FDTABLES_H
+#define FDTABLES_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// The fields fetched for each file descriptor (see fdt_options)
+#define FDT_FIELD_STAT  0x1   // The inode, device and mode (one stat per FD)
+#define FDT_FIELD_LINK  0x2   // The link target (one readlink per FD)
+#define FDT_FIELD_FDINFO 0x4  // The offset, open flags and mount ID (one fdinfo read per FD)
+#define FDT_FIELD_ACCESS 0x8  // The ends a pipe FD holds (one lstat per pipe FD, needs the link)
+#define FDT_FIELDS_ALL  (FDT_FIELD_STAT | FDT_FIELD_LINK) // The default (fdinfo is opt-in)
+
+// How the FD entries are stat'ed (fdt_options.io): one statx call per FD, or
+// the statx calls of an fd directory queued on io_uring and submitted in
+// batches (the synchronous calls are used if io_uring or its statx is unavailable)
+#define FDT_IO_SYNC  0
+#define FDT_IO_URING 1
+// The default number of statx calls submitted at once with FDT_IO_URING
+#define FDT_IO_BATCH 64
+// The largest batch
+#define FDT_IO_BATCH_MAX 4096
+
+/** @brief The filter deciding which processes are scanned.
+ *
+ *  Every check is evaluated before any FD work, from the cheapest to the most
+ *  expensive: the PID range needs no system call, the owner (the real UID)
+ *  needs a single fstatat on /proc/[PID], and only the command name glob reads
+ *  a file. The exception is a process whose /proc/[PID] is owned by root: it
+ *  may be root's, a set-user-ID program's or a non-dumpable process', so its
+ *  /proc/[PID]/status is read too (an open, a read and a parse, counted in
+ *  fdt_stats.procs_status_reads). Without all_users, every root process on the
+ *  host costs that read. With a PID set, /proc is not enumerated at all: only
+ *  the PIDs of the set are visited.
+ */
+typedef struct {
+	uid_t uid;         // Only processes owned by this user ("--uid=N")
+	int all_users;     // 1 to accept processes of every user ("--all-users")
+	const char *comm;  // A glob the command name must match ("--comm="), or NULL
+	int pid_min;       // The lowest accepted PID ("--pid-range=A-B")
+	int pid_max;       // The highest accepted PID, or -1 for no limit
+	const int *pids;   // The PID set in ascending order ("--cgroup=", "--pidfile="), or NULL
+	size_t pid_count;  // The number of PIDs in the set
+	int tasks;         // 1 to also scan threads with an FD table of their own ("--threads")
+} fdt_filter;
+
+/** @brief A single open file descriptor captured during a /proc scan.
+ *
+ *  Snapshots store records column by column; an fdt_record is the row view
+ *  filled by fdt_get_record and passed to fdt_next and fdt_foreach clients.
+ */
+typedef struct {
+	int pid;         // The process ID owning the file descriptor
+	int fd;          // The file descriptor number
+	ino_t inode;     // The inode number of the file (0 if stat failed)
+	dev_t dev;       // The device containing the file
+	mode_t mode;     // The file type and mode
+	const char *link;     // The link target, i.e. the file name ("" if readlink failed)
+	const char *endpoint; // What a socket or pipe is connected to, or NULL if not resolved
+	int64_t pos;     // The file offset (-1 unless fdinfo was fetched)
+	int flags;       // The open flags, O_* (-1 unless fdinfo was fetched)
+	int mnt_id;      // The mount ID of the file (-1 unless fdinfo was fetched)
+	int access_mode; // S_IRUSR / S_IWUSR for the ends of a pipe held by the FD (0 if not fetched)
+} fdt_record;
+
+/** @brief The phases of a scan timed in fdt_stats.
+ */
+enum {
+	FDT_PHASE_ENUMERATE,   // Listing the PIDs in /proc
+	FDT_PHASE_FILTER,      // Ownership and other process filter checks
+	FDT_PHASE_STAT,        // stat and readlink of each FD (summed over threads)
+	FDT_PHASE_SCAN,        // The whole scan, from the first PID to the last FD
+	FDT_PHASE_COUNT
+};
+
+// The largest errno value recorded separately in fdt_stats
+#define FDT_STATS_MAX_ERRNO 256
+
+/** @brief Scan instrumentation, collected if fdt_options.stats points to it.
+ *
+ *  The counters add up over every scan given the same fdt_stats, and are
+ *  updated with relaxed atomics, since worker threads share them. Without
+ *  instrumentation, every update is a single predictable branch.
+ */
+typedef struct {
+	uint64_t phase_ns[FDT_PHASE_COUNT];    // Time spent in each phase
+	uint64_t procs_visited;                // PIDs found in /proc
+	uint64_t procs_skipped;                // PIDs rejected by the process filter
+	uint64_t procs_vanished;               // Processes that exited while being scanned
+	uint64_t procs_unreadable;             // Processes whose fd directory could not be read
+	uint64_t procs_scanned;                // Processes whose fd directory was read
+	uint64_t procs_status_reads;           // Root-owned processes whose status was read
+	uint64_t fds_seen;                     // FD entries found
+	uint64_t fds_stated;                   // FDs successfully stat'ed
+	uint64_t uring_batches;                // Batches of statx submitted through io_uring
+	uint64_t stat_errors[FDT_STATS_MAX_ERRNO];     // Failed stats, by errno
+	uint64_t readlink_errors[FDT_STATS_MAX_ERRNO]; // Failed readlinks, by errno
+	uint64_t fdinfo_errors[FDT_STATS_MAX_ERRNO];   // Failed fdinfo reads, by errno
+} fdt_stats;
+
+/** @brief The options of a scanner (see fdt_default_options).
+ */
+typedef struct {
+	fdt_filter filter;     // Which processes are scanned; filter.comm must outlive the scanner
+	int fields;            // The fields fetched for each FD (FDT_FIELD_* flags)
+	int jobs;              // Number of worker threads used by fdt_scan
+	const char *proc_root; // The directory the process information is read from ("/proc")
+	int io;                // How the FD entries are stat'ed (FDT_IO_SYNC or FDT_IO_URING)
+	unsigned io_batch;     // The statx calls submitted at once with FDT_IO_URING
+	fdt_stats *stats;      // The instrumentation to update, or NULL
+} fdt_options;
+
+// An opaque scanner handle, created by fdt_open and freed by fdt_close
+typedef struct fdt_scanner fdt_scanner;
+
+// The records of a scan, owned by a scanner (see fdt_get_snapshot and fdt_stream)
+typedef struct fdt_snapshot fdt_snapshot;
+
+// Called by fdt_foreach for each record; returning nonzero stops the scan
+typedef int (*fdt_callback)(const fdt_record *rec, void *arg);
+// Called by fdt_stream with the records of one process; returning nonzero stops the stream
+typedef int (*fdt_batch_callback)(const fdt_snapshot *batch, void *arg);
+
+// The scanner API
+void fdt_default_options(fdt_options *options);
+fdt_scanner *fdt_open(const fdt_options *options);
+ssize_t fdt_scan(fdt_scanner *scanner, int pid);
+const fdt_record *fdt_next(fdt_scanner *scanner, size_t *cursor);
+int fdt_foreach(fdt_scanner *scanner, int pid, fdt_callback callback, void *arg);
+int fdt_stream(fdt_scanner *scanner, int pid, size_t queue, fdt_batch_callback callback,
+	void *arg);
+fdt_snapshot *fdt_get_snapshot(fdt_scanner *scanner);
+size_t fdt_snapshot_size(const fdt_snapshot *snap);
+void fdt_get_record(const fdt_snapshot *snap, size_t i, fdt_record *rec);
+void fdt_close(fdt_scanner *scanner);
+
+#endif
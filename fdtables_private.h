@@ -0,0 +1,196 @@
+/** @file fdtables_private.h
+ *  @brief The internals of libfdtables shared with showFDtables
+ *
+ *  This header is not installed with the library. It defines the snapshot
+ *  layout and declares the lower-level scanning functions that showFDtables
+ *  builds its watch modes and exports on. The functions are hidden: the
+ *  shared library does not export them, and the static library localizes
+ *  them, so a program linking libfdtables only sees the fdt_* API. Like the
+ *  API, they report failures through their return value and errno.
+ *
+ *  @author Huang Xinzi
+ *  @bug No known bugs.
+ */
+
+#ifndef FDTABLES_PRIVATE_H
+#define FDTABLES_PRIVATE_H
+
+#include <stdio.h>
+#include "fdtables.h"
+
+// The size of the buffer directory entries are read into with getdents64
+#define DENTS_BUF_SIZE (32 * 1024)
+
+/** @brief A process captured during a /proc scan.
+ *
+ *  Every process of a snapshot either passed the process filter or is the
+ *  target PID of the scan, whose owner is not checked.
+ */
+typedef struct {
+	int pid;         // The process ID
+	size_t first;    // Index of the process' first record in the snapshot
+	int fd_num;      // The number of file descriptors of the process
+	uint64_t starttime; // The start time of the process (only read in watch mode)
+} proc_record;
+
+// The size of an arena block; longer strings get a block of their own
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+/** @brief A block of an arena (see arena_alloc).
+ */
+typedef struct arena_block {
+	struct arena_block *next; // The next block of the arena, or NULL
+	size_t size;              // The capacity of data
+	size_t used;              // The bytes of data handed out
+	char data[];              // The storage
+} arena_block;
+
+/** @brief A bump allocator whose blocks are kept for the next scan.
+ *
+ *  Allocations are never freed one by one: arena_reset empties every block at
+ *  once, and arena_free returns the blocks to the system.
+ */
+typedef struct {
+	arena_block *head;    // The first block, or NULL
+	arena_block *current; // The block allocations are bumped from
+} arena;
+
+/** @brief A set of strings stored once in an arena (see pool_string).
+ */
+typedef struct {
+	const char **slots;   // Open addressing table of interned strings (NULL if empty)
+	uint32_t *hashes;     // The hash of the string in each slot
+	size_t *offsets;      // The offset of the string in each slot (see pool_offset)
+	size_t cap;           // Number of slots (a power of two)
+	size_t count;         // Number of interned strings
+	size_t size;          // Bytes of all interned strings, terminators included
+	arena strings;        // The storage of the interned strings
+} string_pool;
+
+/** @brief An in-memory snapshot of the FD tables, filled by one /proc scan.
+ *
+ *  Every table, the threshold report and both file exports are rendered from
+ *  the same snapshot, so they all agree with each other. The records are
+ *  stored as columns, so a pass over one field (the inodes of the file index,
+ *  the links of the socket resolution) reads only that field, and the link
+ *  targets are interned: a file held by many processes is stored once. The
+ *  columns and the string storage are kept from one scan to the next.
+ */
+struct fdt_snapshot {
+	int *pid;           // The owning process of each record, grouped by process
+	int *fd;            // The file descriptor number of each record
+	ino_t *inode;       // The inode of each record (0 if stat failed)
+	dev_t *dev;         // The device of each record
+	mode_t *mode;       // The file type and mode of each record
+	const char **link;  // The interned link target of each record
+	const char **endpoint; // The interned endpoint of each record, or NULL if
+	                    // no endpoint was ever resolved in this snapshot
+	int64_t *pos;       // The file offset of each record, or NULL (like flags
+	int *flags;         // and mnt_id) if no fdinfo was ever fetched
+	int *mnt_id;        // The mount ID of each record
+	int *access_mode;   // The pipe access mode of each record, or NULL if never fetched
+	int fields;         // The FDT_FIELD_* flags the records were captured with
+	size_t fd_count;    // Number of records
+	size_t fd_cap;      // Allocated capacity of the columns
+	proc_record *procs; // All captured processes, in /proc order
+	size_t proc_count;  // Number of records in procs
+	size_t proc_cap;    // Allocated capacity of procs
+	string_pool strings; // The link targets and endpoints of the records
+	int *uring_failed;  // The flag set once io_uring fails for the scanner filling
+	                    // this snapshot (shared with its workers' snapshots), or NULL
+};
+
+/** @brief A batched reader of directory entries (see next_dent).
+ *
+ *  Entries are fetched with getdents64 into a large buffer, so a directory with
+ *  thousands of entries is read with a handful of system calls.
+ */
+typedef struct {
+	int fd;                      // The directory being read
+	long len;                    // Number of valid bytes in buf
+	long pos;                    // Offset of the next entry in buf
+	char buf[DENTS_BUF_SIZE];    // The raw linux_dirent64 records
+} dent_reader;
+
+/** @brief The number of file descriptors of one process.
+ */
+typedef struct {
+	int pid;         // The process ID
+	int fd_num;      // The number of file descriptors of the process
+	uint64_t starttime; // The start time (see read_starttime), or 0 if not read
+} fd_count;
+
+// Add n to a counter of an instrumentation struct, unless the pointer is NULL
+#define STATS_ADD(stats, counter, n) do { \
+	if ((stats) != NULL) { \
+		__atomic_fetch_add(&(stats) -> counter, (n), __ATOMIC_RELAXED); \
+	} \
+} while (0)
+
+// The protocols of the sockets in a socket_index
+#define SOCKET_TCP  1
+#define SOCKET_UDP  2
+#define SOCKET_UNIX 3
+
+// The state of a listening Unix domain socket (the kernel reports it as unconnected)
+#define SOCKET_LISTENING 0xff
+
+/** @brief One socket of the /proc/net tables.
+ */
+typedef struct {
+	uint64_t inode;            // The inode number of the socket (0 marks an empty slot)
+	uint8_t proto;             // SOCKET_TCP, SOCKET_UDP or SOCKET_UNIX
+	uint8_t state;             // The kernel state (e.g. 10 is TCP LISTEN)
+	uint8_t unix_type;         // The socket type of a Unix socket (1 is SOCK_STREAM)
+	uint8_t family;            // AF_INET, AF_INET6 or AF_UNIX
+	uint16_t local_port;       // The local port (internet sockets)
+	uint16_t remote_port;      // The remote port (internet sockets)
+	uint32_t path;             // 1 + offset of a Unix socket's path in paths, or 0
+	unsigned char local[16];   // The local address, in network byte order
+	unsigned char remote[16];  // The remote address, in network byte order
+} socket_entry;
+
+/** @brief The sockets of /proc/net/{tcp,tcp6,udp,udp6,unix}, hashed by inode.
+ */
+typedef struct {
+	socket_entry *slots;   // The hash slots (linear probing)
+	size_t cap;            // Number of slots (a power of two)
+	size_t count;          // Number of sockets
+	char *paths;           // The bound paths of Unix sockets, NUL-terminated
+	size_t paths_size;     // Number of bytes used in paths
+	size_t paths_cap;      // Allocated size of paths
+} socket_index;
+
+// Lower-level scanning functions, shared with showFDtables
+#pragma GCC visibility push(hidden)
+uint64_t stats_clock(const fdt_stats *stats);
+int grow_array(void **array, size_t *cap, size_t count, size_t size);
+size_t pool_offset(string_pool *pool, const char *str, size_t len);
+int pool_write(const string_pool *pool, FILE *file);
+void pool_free(string_pool *pool);
+void clear_snapshot(fdt_snapshot *snap);
+void free_snapshot(fdt_snapshot *snap);
+int add_record(fdt_snapshot *snap, const fdt_record *rec);
+int set_endpoint(fdt_snapshot *snap, size_t i, const char *endpoint);
+int sort_records(fdt_snapshot *snap, size_t first, size_t count);
+const char *next_dent(dent_reader *reader);
+int open_proc_root(const fdt_options *options);
+int open_pid_dir(int proc_fd, int pid, const fdt_options *options);
+int show_FD(int pid, int pid_dir, const fdt_options *options, fdt_snapshot *snap);
+int filter_pid(const fdt_filter *filter, int pid);
+int next_pid(dent_reader *reader, const fdt_options *options, size_t *index);
+int read_pid_file(int dir_fd, const char *path, int **pids, size_t *count, size_t *cap);
+int read_cgroup_pids(const char *path, int **pids, size_t *count, size_t *cap);
+size_t sort_pids(int *pids, size_t count);
+int filter_process(const fdt_options *options, int proc_fd, int pid);
+ssize_t count_files(fd_count **counts, const fdt_options *options, int starttimes);
+uint64_t read_starttime(int pid_dir);
+uint64_t hash_inode(uint64_t inode);
+int build_socket_index(socket_index *index, const fdt_options *options);
+const socket_entry *find_socket(socket_index *index, uint64_t inode);
+void format_socket(const socket_index *index, const socket_entry *entry, char *buf,
+	size_t size);
+void free_socket_index(socket_index *index);
+#pragma GCC visibility pop
+
+#endif
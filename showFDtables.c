@@ -8,393 +8,2500 @@
  *  each open file descriptor. This program can display the output in various
  *  formats, including composite, per-process, system-wide, and vnode tables.
  *  You can also output the composite table into a text or binary file.
+ *  Scanning is done by the libfdtables library (see fdtables.h, and
+ *  fdtables_private.h for the internals this program builds on); this file
+ *  holds the command line, the tables, the reports and the file formats.
  *
  *  @author Huang Xinzi
  *  @bug No known bugs.
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
-#include <dirent.h>
 #include <unistd.h>
-#include <ctype.h>
 #include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <stdint.h>
+#include <endian.h>
+#include <time.h>
+#include "fdtables_private.h"
+
+// The table formats a snapshot can be rendered in
+#define TABLE_COMPOSITE   0
+#define TABLE_PER_PROCESS 1
+#define TABLE_SYSTEM_WIDE 2
+#define TABLE_VNODE       3
+#define TABLE_OPENED      4   // A file descriptor opened since the last refresh
+#define TABLE_CLOSED      5   // A file descriptor closed since the last refresh
+#define TABLE_FDINFO      6   // The offset, open flags and mount ID ("--fdinfo")
+#define TABLE_CSV         7   // Comma-separated values ("--format=csv")
+#define TABLE_JSONL       8   // One JSON object per line ("--format=jsonl")
+#define TABLE_CSV_FDINFO  9   // TABLE_CSV with the fdinfo columns
+#define TABLE_JSONL_FDINFO 10 // TABLE_JSONL with the fdinfo members
+
+// The header line of "--format=csv"
+#define CSV_HEADER "pid,fd,dev,inode,filename,endpoint\n"
+// The header line of the CSV format with "--fdinfo"
+#define CSV_FDINFO_HEADER "pid,fd,dev,inode,filename,endpoint,pos,flags,mnt_id\n"
+// The header line of "--diff" in CSV format: a change ("+" or "-") per row
+#define DIFF_CSV_HEADER "change," CSV_HEADER
+
+// The size of the buffer rows are formatted into before being written
+#define OUT_BUF_SIZE (64 * 1024)
+
+// The number of processes "--stream" queues between the scan and the output
+#define STREAM_QUEUE 64
+
+// The defaults of "--leak-watch=": the samples kept per process, the growth
+// (FDs per minute) and the projected time to the limit (seconds) that alert
+#define LEAK_WINDOW  16
+#define LEAK_RATE    10.0
+#define LEAK_HORIZON 3600.0
+// The largest window ("--leak-window=N")
+#define LEAK_WINDOW_MAX 1024
+// The samples a window needs before its slope is trusted
+#define LEAK_MIN_SAMPLES 3
+
+// The magic number and format version of binary snapshot files
+#define BIN_MAGIC   "FDTABLES"
+#define BIN_VERSION 1
+
+/** @brief The command line options, filled by vertify_arg.
+ */
+typedef struct {
+	int per_process;   // 1 if "--per-process" is been called
+	int sysWide;       // 1 if "--systemWide" is been called
+	int vnode;         // 1 if "--Vnodes" is been called
+	int composite;     // 1 if "--composite" is been called
+	int txt;           // 1 if "--output_TXT" is been called
+	int binary;        // 1 if "--output_binary" is been called
+	int pid;           // The target process ID, or -1 for all user-owned processes
+	int threshold;     // The value of "--threshold=X", or -1 if not set
+	int top;           // The value of "--top=K", or -1 if not set
+	fdt_options scan;  // The scanner options: the process filter ("--uid=",
+	                   // "--all-users", ...), "--jobs=N", "--proc-root=DIR", "--io=", ...
+	const char *dump;  // The binary snapshot to print ("--dump=FILE"), or NULL
+	double watch;      // Seconds between refreshes ("--watch=INTERVAL"), or 0
+	int files;         // 1 if "--files" (or "--inode=N" / "--path=P") is been called
+	long inode;        // The value of "--inode=N", or 0 if not set
+	const char *path;  // The value of "--path=P", or NULL if not set
+	int format;        // TABLE_CSV or TABLE_JSONL ("--format="), or 0 for the text tables
+	int resolve;       // 1 if "--resolve-sockets" is been called
+	int fdinfo;        // 1 if "--fdinfo" is been called
+	const char *diff[2]; // The binary snapshots to compare ("--diff OLD NEW"), or NULL
+	int query_pid;     // The value of "--pid=N", or -1 if not set
+	const char *prefix; // The value of "--path-prefix=P", or NULL if not set
+	size_t stream;     // The queue size of "--stream[=N]", or 0 if not set
+	int *pids;         // The positional PIDs and those of "--cgroup=" and "--pidfile="
+	size_t pid_count;  // The number of PIDs in pids
+	size_t pid_cap;    // The capacity of pids
+	int pid_set;       // 1 if "--cgroup=" or "--pidfile=" is been called
+	double leak_watch; // Seconds between samples ("--leak-watch=INTERVAL"), or 0
+	int leak_window;   // The samples kept per process ("--leak-window=N")
+	double leak_rate;  // The growth in FDs per minute that alerts ("--leak-rate=R")
+	double leak_horizon; // The time to the limit in seconds that alerts ("--leak-horizon=S")
+} fd_options;
+
+/** @brief The phases of a run timed by "--stats" after the scan (the scan's own
+ *  phases are timed by the library, see fdt_stats).
+ */
+enum {
+	PHASE_RESOLVE,     // Resolving socket and pipe endpoints
+	PHASE_TABLES,      // Formatting the tables and reports on stdout
+	PHASE_TXT,         // Writing compositeTable.txt
+	PHASE_BINARY,      // Writing compositeTable.bin
+	PHASE_COUNT
+};
+
+/** @brief The output sinks whose written bytes are counted by "--stats".
+ */
+enum {
+	SINK_STDOUT,
+	SINK_TXT,
+	SINK_BINARY,
+	SINK_COUNT
+};
+
+/** @brief The instrumentation of a run, collected when "--stats" is given.
+ */
+typedef struct {
+	int json;                              // 1 for "--stats=json"
+	uint64_t started;                      // When the run started (see run_clock)
+	fdt_stats scan;                        // The scan counters, filled by the library
+	uint64_t phase_ns[PHASE_COUNT];        // Time spent in each phase after the scan
+	uint64_t bytes[SINK_COUNT];            // Bytes written to each sink
+} run_stats;
+
+// The instrumentation of this run, and the pointer to it that stays NULL
+// unless "--stats" is given
+static run_stats stats_data;
+run_stats *stats = NULL;
 
 /** @brief Display error message and then terminate the program.
  * 	
  *  @param message - A string containing the error message.
  *  @return Void.
  */
-void handle_error(char *message) {
-	printf("%s\n", message);
-	exit(0);
+void handle_error(char *message) {
+	printf("%s\n", message);
+	exit(0);
+}
+
+/** @brief Report a failed scan.
+ *
+ *  Running out of memory ends the program; any other error (an unreadable
+ *  proc root) is printed, and the output is rendered from what was captured.
+ *
+ *  @return Void.
+ */
+void scan_failed(void) {
+	if (errno == ENOMEM) {
+		handle_error("Out of memory while building the FD snapshot!");
+	}
+	perror("opendir");
+}
+
+/** @brief Read the monotonic clock for a phase timing.
+ *
+ *  @return The time in nanoseconds, or 0 if "--stats" is not given.
+ */
+uint64_t run_clock(void) {
+	return stats != NULL ? stats_clock(&stats -> scan) : 0;
+}
+
+/** @brief Add the time elapsed since start to a phase.
+ *
+ *  @param phase - The phase (one of the PHASE_* values).
+ *  @param start - The time returned by run_clock when the phase started.
+ *  @return Void.
+ */
+void run_phase(int phase, uint64_t start) {
+	STATS_ADD(stats, phase_ns[phase], run_clock() - start);
+}
+
+/** @brief Print the per-errno counters of stats.
+ *
+ *  @param out - The stream to write to.
+ *  @param errors - The per-errno counters.
+ *  @param json - 1 to print a JSON object, 0 for text.
+ *  @return Void.
+ */
+void print_stats_errors(FILE *out, const uint64_t *errors, int json) {
+	int first = 1;
+	fprintf(out, json ? "{" : "");
+	for (int err = 0; err < FDT_STATS_MAX_ERRNO; err ++) {
+		if (errors[err] == 0) {
+			continue;
+		}
+		const char *name = err ? strerrorname_np(err) : NULL;
+		char number[16];
+		if (name == NULL) {
+			snprintf(number, sizeof(number), "%d", err);
+			name = number;
+		}
+		fprintf(out, json ? "%s\"%s\":%llu" : "%s%s=%llu", first ? "" : json ? "," : " ",
+			name, (unsigned long long) errors[err]);
+		first = 0;
+	}
+	fprintf(out, json ? "}" : first ? "none" : "");
+}
+
+/** @brief Print the collected stats on stderr, as a text trailer or as JSON.
+ *
+ *  @return Void.
+ */
+void print_stats(void) {
+	const char *phases[FDT_PHASE_COUNT + PHASE_COUNT] = {"enumerate", "filter", "stat", "scan",
+		"resolve", "tables", "txt", "binary"};
+	const char *sinks[SINK_COUNT] = {"stdout", "txt", "binary"};
+	const fdt_stats *scan = &stats -> scan;
+	int json = stats -> json;
+
+	fflush(stdout);
+	fprintf(stderr, json ? "{\"phases_ms\":{" : "## Stats:\n\tPhases (ms):");
+	// The scan's phases come first, then those of this program
+	for (int i = 0; i < FDT_PHASE_COUNT + PHASE_COUNT; i ++) {
+		uint64_t ns = i < FDT_PHASE_COUNT ? scan -> phase_ns[i]
+			: stats -> phase_ns[i - FDT_PHASE_COUNT];
+		fprintf(stderr, json ? "%s\"%s\":%.3f" : "%s%s=%.3f", json ? (i ? "," : "") : " ",
+			phases[i], ns / 1e6);
+	}
+	fprintf(stderr, json ? ",\"total\":%.3f" : " total=%.3f",
+		(run_clock() - stats -> started) / 1e6);
+	fprintf(stderr, json ? "},\"processes\":{\"visited\":%llu,\"skipped\":%llu,"
+		"\"vanished\":%llu,\"unreadable\":%llu,\"scanned\":%llu,\"status_reads\":%llu},"
+		: "\n\tProcesses: visited=%llu skipped=%llu vanished=%llu unreadable=%llu "
+		"scanned=%llu status_reads=%llu\n",
+		(unsigned long long) scan -> procs_visited, (unsigned long long) scan -> procs_skipped,
+		(unsigned long long) scan -> procs_vanished, (unsigned long long) scan -> procs_unreadable,
+		(unsigned long long) scan -> procs_scanned,
+		(unsigned long long) scan -> procs_status_reads);
+	fprintf(stderr, json ? "\"fds\":{\"seen\":%llu,\"stated\":%llu,\"uring_batches\":%llu,"
+		"\"stat_errors\":" : "\tFDs: seen=%llu stated=%llu uring_batches=%llu\n\tstat errors: ",
+		(unsigned long long) scan -> fds_seen, (unsigned long long) scan -> fds_stated,
+		(unsigned long long) scan -> uring_batches);
+	print_stats_errors(stderr, scan -> stat_errors, json);
+	fprintf(stderr, json ? ",\"readlink_errors\":" : "\n\treadlink errors: ");
+	print_stats_errors(stderr, scan -> readlink_errors, json);
+	fprintf(stderr, json ? ",\"fdinfo_errors\":" : "\n\tfdinfo errors: ");
+	print_stats_errors(stderr, scan -> fdinfo_errors, json);
+	fprintf(stderr, json ? "},\"bytes\":{" : "\n\tBytes written:");
+	for (int i = 0; i < SINK_COUNT; i ++) {
+		fprintf(stderr, json ? "%s\"%s\":%llu" : "%s%s=%llu", json ? (i ? "," : "") : " ",
+			sinks[i], (unsigned long long) stats -> bytes[i]);
+	}
+	fprintf(stderr, json ? "}}\n" : "\n");
+}
+
+/** @brief Write callback of a stream that counts the bytes passed through it.
+ */
+ssize_t counting_write(void *cookie, const char *buf, size_t size) {
+	ssize_t written = write(STDOUT_FILENO, buf, size);
+	if (written > 0) {
+		*(uint64_t *) cookie += written;
+	}
+	return written;
+}
+
+/** @brief Replace stdout with a stream that counts the bytes written to it.
+ *
+ *  @return Void.
+ */
+void count_stdout(void) {
+	cookie_io_functions_t io = {NULL, counting_write, NULL, NULL};
+	FILE *counted = fopencookie(&stats -> bytes[SINK_STDOUT], "w", io);
+	if (counted != NULL) {
+		fflush(stdout);
+		stdout = counted;
+	}
+}
+
+/** @brief Read the soft limit on open files (RLIMIT_NOFILE) of a process.
+ *
+ *  @param proc_root - The directory the process information is read from.
+ *  @param pid - The process ID.
+ *  @param limit - A string to store the limit in (e.g. "1024" or "unlimited").
+ *  @param size - The size of limit.
+ *  @return Void. limit is set to "?" if it cannot be read.
+ */
+void read_fd_limit(const char *proc_root, int pid, char *limit, size_t size) {
+	char path[PATH_MAX]; // A string indicating the path to /proc/[PID]/limits
+	char line[256];      // To store each line when reading the file
+	FILE *fp;            // A file pointer to "/proc/[PID]/limits"
+
+	snprintf(limit, size, "?");
+	snprintf(path, sizeof(path), "%s/%d/limits", proc_root, pid);
+	if ((fp = fopen(path, "r")) == NULL) {
+		return;
+	}
+	while (fgets(line, sizeof(line), fp)) {
+		char soft[32];
+		if (sscanf(line, "Max open files %31s", soft) == 1) {
+			snprintf(limit, size, "%s", soft);
+			break;
+		}
+	}
+	fclose(fp);
+}
+
+/** @brief Read the soft limit on open files (RLIMIT_NOFILE) of a process as a number.
+ *
+ *  @param proc_root - The directory the process information is read from.
+ *  @param pid - The process ID.
+ *  @return The limit, or -1 if it is unlimited or cannot be read.
+ */
+long read_fd_limit_value(const char *proc_root, int pid) {
+	char limit[32], *end;
+	read_fd_limit(proc_root, pid, limit, sizeof(limit));
+	long value = strtol(limit, &end, 10);
+	return end != limit && *end == '\0' ? value : -1;
+}
+
+/** @brief Check whether one count ranks below another in the top-K report.
+ *
+ *  Fewer file descriptors rank lower; on a tie the larger PID ranks lower.
+ *
+ *  @param a - A pointer to the first count.
+ *  @param b - A pointer to the second count.
+ *  @return 1 if a ranks below b, 0 otherwise.
+ */
+int count_below(const fd_count *a, const fd_count *b) {
+	return a -> fd_num < b -> fd_num || (a -> fd_num == b -> fd_num && a -> pid > b -> pid);
+}
+
+/** @brief Compare two counts for qsort, highest ranking first.
+ */
+int compare_counts(const void *a, const void *b) {
+	return count_below(a, b) ? 1 : count_below(b, a) ? -1 : 0;
+}
+
+/** @brief Keep the K highest ranking counts in a bounded min-heap.
+ *
+ *  @param heap - The heap array (with room for top elements).
+ *  @param size - A pointer to the number of elements in the heap.
+ *  @param top - The capacity of the heap (K).
+ *  @param item - The count to offer to the heap.
+ *  @return Void.
+ */
+void heap_offer(fd_count *heap, size_t *size, size_t top, fd_count item) {
+	size_t i;
+	if (*size < top) {
+		// Sift the new item up from the bottom
+		for (i = (*size) ++; i > 0 && count_below(&item, &heap[(i - 1) / 2]); i = (i - 1) / 2) {
+			heap[i] = heap[(i - 1) / 2];
+		}
+		heap[i] = item;
+		return;
+	}
+	if (top == 0 || !count_below(&heap[0], &item)) {
+		return;
+	}
+	// Replace the lowest ranking item (the root) and sift the new item down
+	for (i = 0; 2 * i + 1 < *size; ) {
+		size_t child = 2 * i + 1;
+		if (child + 1 < *size && count_below(&heap[child + 1], &heap[child])) {
+			child ++;
+		}
+		if (!count_below(&heap[child], &item)) {
+			break;
+		}
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = item;
+}
+
+/** @brief A reusable output buffer flushed with write/writev.
+ *
+ *  Rows are formatted straight into buf, without stdio, and the buffer is
+ *  only written out when it is full or the caller is done.
+ */
+typedef struct {
+	int fd;                  // The file descriptor written to
+	int sink;                // The sink counted by "--stats" (one of the SINK_* values)
+	size_t len;              // Number of bytes buffered
+	char buf[OUT_BUF_SIZE];  // The buffered bytes
+} out_buffer;
+
+// The buffer shared by everything written to stdout without stdio
+static out_buffer stdout_out = {.fd = STDOUT_FILENO, .sink = SINK_STDOUT};
+
+/** @brief Write a list of buffers completely, retrying partial writes.
+ *
+ *  @param fd - The file descriptor to write to.
+ *  @param iov - The buffers to write (modified on partial writes).
+ *  @param count - The number of buffers.
+ *  @return 0 on success, -1 on error (errno is set).
+ */
+int write_all(int fd, struct iovec *iov, int count) {
+	while (count > 0) {
+		ssize_t written = writev(fd, iov, count);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		// Skip the buffers (and the part of a buffer) already written
+		while (count > 0 && (size_t) written >= iov -> iov_len) {
+			written -= iov -> iov_len;
+			iov ++;
+			count --;
+		}
+		if (count > 0) {
+			iov -> iov_base = (char *) iov -> iov_base + written;
+			iov -> iov_len -= written;
+		}
+	}
+	return 0;
+}
+
+/** @brief Write the buffered bytes, followed by extra bytes, in a single writev.
+ *
+ *  @param out - A pointer to the output buffer.
+ *  @param data - Extra bytes to write after the buffered ones (may be NULL).
+ *  @param size - The number of extra bytes.
+ *  @return Void.
+ */
+void out_flush_with(out_buffer *out, const char *data, size_t size) {
+	struct iovec iov[2] = {{out -> buf, out -> len}, {(char *) data, size}};
+	if (out -> len + size == 0) {
+		return;
+	}
+	if (write_all(out -> fd, iov, size > 0 ? 2 : 1) != 0) {
+		perror("write");
+	} else {
+		STATS_ADD(stats, bytes[out -> sink], out -> len + size);
+	}
+	out -> len = 0;
+}
+
+/** @brief Write the buffered bytes.
+ *
+ *  @param out - A pointer to the output buffer.
+ *  @return Void.
+ */
+void out_flush(out_buffer *out) {
+	out_flush_with(out, NULL, 0);
+}
+
+/** @brief Start writing to stdout through the shared buffer.
+ *
+ *  Whatever stdio has buffered is flushed first, so the output stays in order.
+ *  The caller must call out_flush before using stdio on stdout again.
+ *
+ *  @return A pointer to the shared stdout buffer.
+ */
+out_buffer *out_stdout(void) {
+	fflush(stdout);
+	return &stdout_out;
+}
+
+/** @brief Make room for n bytes in the buffer (n <= OUT_BUF_SIZE).
+ *
+ *  @param out - A pointer to the output buffer.
+ *  @param n - The number of bytes about to be appended.
+ *  @return A pointer to where the bytes go.
+ */
+static inline char *out_reserve(out_buffer *out, size_t n) {
+	if (out -> len + n > OUT_BUF_SIZE) {
+		out_flush(out);
+	}
+	return out -> buf + out -> len;
+}
+
+/** @brief Append bytes to the buffer. Bytes that do not fit are written
+ *  together with the buffer.
+ *
+ *  @param out - A pointer to the output buffer.
+ *  @param data - The bytes to append.
+ *  @param size - The number of bytes.
+ *  @return Void.
+ */
+static inline void out_write(out_buffer *out, const char *data, size_t size) {
+	if (out -> len + size > OUT_BUF_SIZE) {
+		out_flush_with(out, data, size);
+		return;
+	}
+	memcpy(out -> buf + out -> len, data, size);
+	out -> len += size;
+}
+
+/** @brief Append a NUL-terminated string to the buffer.
+ */
+static inline void out_str(out_buffer *out, const char *str) {
+	out_write(out, str, strlen(str));
+}
+
+/** @brief Append a single character to the buffer.
+ */
+static inline void out_char(out_buffer *out, char c) {
+	*out_reserve(out, 1) = c;
+	out -> len ++;
+}
+
+/** @brief Append an unsigned integer in decimal, without printf.
+ *
+ *  @param out - A pointer to the output buffer.
+ *  @param value - The integer.
+ *  @return Void.
+ */
+static inline void out_uint(out_buffer *out, uint64_t value) {
+	char digits[20];   // The decimal digits, least significant first
+	int n = 0;
+	do {
+		digits[n ++] = '0' + value % 10;
+		value /= 10;
+	} while (value != 0);
+
+	char *dst = out_reserve(out, n);
+	out -> len += n;
+	while (n > 0) {
+		*dst ++ = digits[-- n];
+	}
+}
+
+/** @brief Append an unsigned integer in octal with a leading 0, like /proc does for flags.
+ */
+static inline void out_oct(out_buffer *out, unsigned int value) {
+	char digits[12];   // The octal digits, least significant first
+	int n = 0;
+	do {
+		digits[n ++] = '0' + (value & 7);
+		value >>= 3;
+	} while (value != 0);
+
+	char *dst = out_reserve(out, n + 1);
+	out -> len += n + 1;
+	*dst ++ = '0';
+	while (n > 0) {
+		*dst ++ = digits[-- n];
+	}
+}
+
+/** @brief Append a signed integer in decimal, without printf.
+ */
+static inline void out_int(out_buffer *out, int64_t value) {
+	if (value < 0) {
+		out_char(out, '-');
+		out_uint(out, -(uint64_t) value);
+	} else {
+		out_uint(out, value);
+	}
+}
+
+/** @brief Append a string as a CSV field, quoted only if it has to be.
+ *
+ *  @param out - A pointer to the output buffer.
+ *  @param str - The field value.
+ *  @return Void.
+ */
+void out_csv_str(out_buffer *out, const char *str) {
+	if (strpbrk(str, ",\"\r\n") == NULL) {
+		out_str(out, str);
+		return;
+	}
+	out_char(out, '"');
+	for (; *str; str ++) {
+		if (*str == '"') {
+			out_char(out, '"');
+		}
+		out_char(out, *str);
+	}
+	out_char(out, '"');
+}
+
+/** @brief Measure the UTF-8 sequence at the start of a string.
+ *
+ *  @param str - The string.
+ *  @return The length of the sequence (1 to 4 bytes), or 0 if it is not valid
+ * 			UTF-8 (a stray continuation byte, a truncated or overlong sequence,
+ * 			a surrogate or a code point past U+10FFFF).
+ */
+static inline int utf8_length(const unsigned char *str) {
+	unsigned char c = str[0];
+	int len;
+	uint32_t min, code;
+	if (c < 0x80) {
+		return 1;
+	} else if (c >= 0xc2 && c <= 0xdf) {
+		len = 2, min = 0x80, code = c & 0x1f;
+	} else if (c >= 0xe0 && c <= 0xef) {
+		len = 3, min = 0x800, code = c & 0x0f;
+	} else if (c >= 0xf0 && c <= 0xf4) {
+		len = 4, min = 0x10000, code = c & 0x07;
+	} else {
+		return 0;
+	}
+	for (int i = 1; i < len; i ++) {
+		// The terminator is not a continuation byte, so this stops at the end
+		if ((str[i] & 0xc0) != 0x80) {
+			return 0;
+		}
+		code = code << 6 | (str[i] & 0x3f);
+	}
+	if (code < min || code > 0x10ffff || (code >= 0xd800 && code <= 0xdfff)) {
+		return 0;
+	}
+	return len;
+}
+
+/** @brief Append a string as a quoted JSON string.
+ *
+ *  File names are bytes, not necessarily UTF-8. Valid UTF-8 sequences are
+ *  copied, and every byte that is not part of one is written as \u00XX (the
+ *  code point of the byte), so the output is always valid JSON.
+ *
+ *  @param out - A pointer to the output buffer.
+ *  @param str - The string value.
+ *  @return Void.
+ */
+void out_json_str(out_buffer *out, const char *str) {
+	static const char hex[] = "0123456789abcdef";
+	out_char(out, '"');
+	while (*str) {
+		unsigned char c = *str;
+		int len = c < 0x80 ? 1 : utf8_length((const unsigned char *) str);
+		if (c == '"' || c == '\\') {
+			out_char(out, '\\');
+			out_char(out, c);
+		} else if (c < 0x20 || len == 0) {
+			char *dst = out_reserve(out, 6);
+			memcpy(dst, "\\u00", 4);
+			dst[4] = hex[c >> 4];
+			dst[5] = hex[c & 15];
+			out -> len += 6;
+			len = 1;
+		} else {
+			memcpy(out_reserve(out, len), str, len);
+			out -> len += len;
+		}
+		str += len;
+	}
+	out_char(out, '"');
+}
+
+/** @brief Write the file name of a record, followed by its endpoint if resolved.
+ */
+static inline void out_filename(out_buffer *out, const fdt_record *rec) {
+	out_str(out, rec -> link);
+	if (rec -> endpoint != NULL) {
+		out_str(out, " (");
+		out_str(out, rec -> endpoint);
+		out_char(out, ')');
+	}
+}
+
+/** @brief Write one composite table row (after the row number).
+ */
+void render_composite(out_buffer *out, const fdt_record *rec) {
+	out_char(out, '\t');
+	out_int(out, rec -> pid);
+	out_char(out, '\t');
+	out_int(out, rec -> fd);
+	out_char(out, '\t');
+	out_filename(out, rec);
+	out_char(out, '\t');
+	out_uint(out, rec -> inode);
+	out_char(out, '\n');
+}
+
+/** @brief Write one per-process table row (after the row number).
+ */
+void render_per_process(out_buffer *out, const fdt_record *rec) {
+	out_char(out, '\t');
+	out_int(out, rec -> pid);
+	out_char(out, '\t');
+	out_int(out, rec -> fd);
+	out_char(out, '\n');
+}
+
+/** @brief Write one system-wide table row (after the row number).
+ */
+void render_system_wide(out_buffer *out, const fdt_record *rec) {
+	out_char(out, '\t');
+	out_int(out, rec -> pid);
+	out_char(out, '\t');
+	out_int(out, rec -> fd);
+	out_char(out, '\t');
+	out_filename(out, rec);
+	out_char(out, '\n');
+}
+
+/** @brief Write one vnode table row (after the row number).
+ */
+void render_vnode(out_buffer *out, const fdt_record *rec) {
+	out_char(out, '\t');
+	out_int(out, rec -> fd);
+	out_char(out, '\t');
+	out_uint(out, rec -> inode);
+	out_char(out, '\n');
+}
+
+/** @brief Write one row of a file descriptor opened since the last refresh.
+ */
+void render_opened(out_buffer *out, const fdt_record *rec) {
+	out_char(out, '+');
+	render_composite(out, rec);
+}
+
+/** @brief Write one row of a file descriptor closed since the last refresh.
+ */
+void render_closed(out_buffer *out, const fdt_record *rec) {
+	out_char(out, '-');
+	render_composite(out, rec);
+}
+
+/** @brief Write one fdinfo table row (after the row number).
+ */
+void render_fdinfo(out_buffer *out, const fdt_record *rec) {
+	out_char(out, '\t');
+	out_int(out, rec -> pid);
+	out_char(out, '\t');
+	out_int(out, rec -> fd);
+	out_char(out, '\t');
+	out_int(out, rec -> pos);
+	out_char(out, '\t');
+	if (rec -> flags != -1) {
+		out_oct(out, rec -> flags);
+	} else {
+		out_str(out, "-1");
+	}
+	out_char(out, '\t');
+	out_int(out, rec -> mnt_id);
+	out_char(out, '\n');
+}
+
+/** @brief Write the columns of the CSV row of a record, without the line break.
+ */
+static inline void out_csv_fields(out_buffer *out, const fdt_record *rec) {
+	out_int(out, rec -> pid);
+	out_char(out, ',');
+	out_int(out, rec -> fd);
+	out_char(out, ',');
+	out_uint(out, rec -> dev);
+	out_char(out, ',');
+	out_uint(out, rec -> inode);
+	out_char(out, ',');
+	out_csv_str(out, rec -> link);
+	out_char(out, ',');
+	if (rec -> endpoint != NULL) {
+		out_csv_str(out, rec -> endpoint);
+	}
+}
+
+/** @brief Write one CSV row (see CSV_HEADER for the columns).
+ */
+void render_csv(out_buffer *out, const fdt_record *rec) {
+	out_csv_fields(out, rec);
+	out_char(out, '\n');
+}
+
+/** @brief Write one CSV row with the fdinfo columns (see CSV_FDINFO_HEADER).
+ */
+void render_csv_fdinfo(out_buffer *out, const fdt_record *rec) {
+	out_csv_fields(out, rec);
+	out_char(out, ',');
+	out_int(out, rec -> pos);
+	out_char(out, ',');
+	if (rec -> flags != -1) {
+		out_oct(out, rec -> flags);
+	} else {
+		out_str(out, "-1");
+	}
+	out_char(out, ',');
+	out_int(out, rec -> mnt_id);
+	out_char(out, '\n');
+}
+
+/** @brief Write the members of the JSON object of a record, without the braces.
+ */
+static inline void out_json_fields(out_buffer *out, const fdt_record *rec) {
+	out_str(out, "\"pid\":");
+	out_int(out, rec -> pid);
+	out_str(out, ",\"fd\":");
+	out_int(out, rec -> fd);
+	out_str(out, ",\"dev\":");
+	out_uint(out, rec -> dev);
+	out_str(out, ",\"inode\":");
+	out_uint(out, rec -> inode);
+	out_str(out, ",\"filename\":");
+	out_json_str(out, rec -> link);
+	if (rec -> endpoint != NULL) {
+		out_str(out, ",\"endpoint\":");
+		out_json_str(out, rec -> endpoint);
+	}
+}
+
+/** @brief Write one JSON object per line.
+ */
+void render_jsonl(out_buffer *out, const fdt_record *rec) {
+	out_char(out, '{');
+	out_json_fields(out, rec);
+	out_str(out, "}\n");
+}
+
+/** @brief Write one JSON object per line, with the fdinfo members.
+ */
+void render_jsonl_fdinfo(out_buffer *out, const fdt_record *rec) {
+	out_char(out, '{');
+	out_json_fields(out, rec);
+	out_str(out, ",\"pos\":");
+	out_int(out, rec -> pos);
+	out_str(out, ",\"flags\":");
+	out_int(out, rec -> flags);
+	out_str(out, ",\"mnt_id\":");
+	out_int(out, rec -> mnt_id);
+	out_str(out, "}\n");
+}
+
+// The title line of each text table, indexed by the TABLE_* values
+static const char *table_titles[] = {
+	"\tPID\tFD\tFilename\t\tInode\n", "\tPID\tFD\n", "\tPID\tFD\tFilename\n", "\tFD\tInode\n",
+	NULL, NULL, "\tPID\tFD\tPos\tFlags\tMntID\n"
+};
+
+// Writes one row of a table format, without the row number
+typedef void (*row_renderer)(out_buffer *out, const fdt_record *rec);
+
+// The renderer of each table format, indexed by the TABLE_* values
+static const row_renderer renderers[] = {
+	render_composite, render_per_process, render_system_wide, render_vnode,
+	render_opened, render_closed, render_fdinfo, render_csv, render_jsonl,
+	render_csv_fdinfo, render_jsonl_fdinfo
+};
+
+/** @brief Write the rows of a snapshot in a specific table format.
+ *
+ *  If a process ID is provided, the snapshot only holds that process, and all
+ *  its rows are written. Otherwise the rows of all user-owned processes are
+ *  written, each prefixed with its row number in the text tables. The
+ *  renderer is picked once, so the loop over the rows tests no flags.
+ *
+ *  @param out - The buffer to write to.
+ *  @param snap - A pointer to the snapshot.
+ *  @param pid - The target process ID, or -1 for all user-owned processes.
+ *  @param format - The table format (one of the TABLE_* values).
+ *  @return Void.
+ */
+void print_rows(out_buffer *out, fdt_snapshot *snap, int pid, int format) {
+	row_renderer render = renderers[format];
+	if (pid != -1) {
+		// The snapshot only holds the target process (and, with "--threads",
+		// its threads that have an FD table of their own)
+		fdt_record rec;
+		for (size_t i = 0; i < snap -> fd_count; i ++) {
+			fdt_get_record(snap, i, &rec);
+			render(out, &rec);
+		}
+		return;
+	}
+
+	int numbered = format < TABLE_CSV; // Only the text tables number their rows
+	int m = 0; // Track the number of total FDs
+	for (size_t p = 0; p < snap -> proc_count; p ++) {
+		proc_record *proc = &snap -> procs[p];
+		fdt_record rec;
+		size_t end = proc -> first + proc -> fd_num;
+		if (numbered) {
+			for (size_t i = proc -> first; i < end; i ++) {
+				fdt_get_record(snap, i, &rec);
+				out_uint(out, m ++);
+				render(out, &rec);
+			}
+		} else {
+			for (size_t i = proc -> first; i < end; i ++) {
+				fdt_get_record(snap, i, &rec);
+				render(out, &rec);
+			}
+		}
+	}
+}
+
+/** @brief Print the FD tables in the requested formats from a snapshot.
+ * 
+ * 	The function sets the default behaviour if no argument is passed to the program
+ *  to display the composite table. If a process ID is provided, the function will
+ *  display the file descriptors of that process in the requested format. If no process
+ * 	ID provided, the function will display the FD tables for all processes owned by the
+ *  current user in the requested format.
+ * 
+ *  @param snap - A pointer to the snapshot to render.
+ *  @param pid - An integer that represents the process ID.
+ * 	             If -1 is passed as an argument, the program will list the open files
+ *               of all processes owned by the current user. Otherwise it will display
+ *               the FD tables for the specified process.
+ *  @param per_process - An integer flag to indicate whether the program will display
+ * 					     a per-process format table.
+ *  @param sysWide - An integer flag to indicate whether the program will display a
+ * 				     system-wide format table.
+ *  @param vnode - An integer flag to indicate whether the program will display a
+ * 				   vnode format table.
+ *  @param composite - An integer flag to indicate whether the program will display a
+ * 					   composite format table.
+ *  @param fdinfo - An integer flag to indicate whether the program will display the
+ * 					fdinfo table (or add the fdinfo columns to csv and jsonl).
+ *  @param format - TABLE_CSV or TABLE_JSONL to print every column of the rows once
+ * 				    in that format instead of the text tables, or 0.
+ *  @return Void.
+ */
+void show_tables(fdt_snapshot *snap, int pid, int per_process, int sysWide, int vnode,
+	int composite, int fdinfo, int format) {
+	// Storing the divided line
+   	char *line = "\t========================================\n";
+	out_buffer *out = out_stdout();
+
+	// The machine-readable formats have a single set of columns
+	if (format == TABLE_CSV || format == TABLE_JSONL) {
+		if (format == TABLE_CSV) {
+			out_str(out, fdinfo ? CSV_FDINFO_HEADER : CSV_HEADER);
+		}
+		print_rows(out, snap, pid, fdinfo ? format + TABLE_CSV_FDINFO - TABLE_CSV : format);
+		out_flush(out);
+		return;
+	}
+
+	// Given the flags' value, display the FD tables in all requested formats.
+	if (composite == 1) { // If the composite flag is on
+		out_str(out, table_titles[TABLE_COMPOSITE]); // Print the title information
+		out_str(out, line);
+		print_rows(out, snap, pid, TABLE_COMPOSITE);
+		out_str(out, line); // Print the divided line
+	}
+	if (per_process == 1) {
+		out_str(out, table_titles[TABLE_PER_PROCESS]);
+		out_str(out, line);
+		print_rows(out, snap, pid, TABLE_PER_PROCESS);
+		out_str(out, line);
+	}
+	if (sysWide == 1) {
+		out_str(out, table_titles[TABLE_SYSTEM_WIDE]);
+		out_str(out, line);
+		print_rows(out, snap, pid, TABLE_SYSTEM_WIDE);
+		out_str(out, line);
+	}
+	if (vnode == 1) {
+		out_str(out, table_titles[TABLE_VNODE]);
+		out_str(out, line);
+		print_rows(out, snap, pid, TABLE_VNODE);
+		out_str(out, line);
+	}
+	if (fdinfo == 1) {
+		out_str(out, table_titles[TABLE_FDINFO]);
+		out_str(out, line);
+		print_rows(out, snap, pid, TABLE_FDINFO);
+		out_str(out, line);
+	}
+	out_flush(out);
+}
+
+/** @brief One open file in the inode index, with the FDs that hold it.
+ */
+typedef struct {
+	dev_t dev;           // The device containing the file
+	ino_t inode;         // The inode number of the file (0 marks an empty slot)
+	size_t first;        // Index of the file's first holder in file_index.holders
+	int holders;         // The number of (PID, FD) pairs holding the file
+} file_entry;
+
+/** @brief An open-addressing hash index of a snapshot keyed by (st_dev, st_ino).
+ *
+ *  Files are hashed by inode only, so that a lookup by inode number alone probes
+ *  the same slots as a lookup by (device, inode).
+ */
+typedef struct {
+	file_entry *slots;   // The hash slots (linear probing)
+	size_t cap;          // Number of slots (a power of two)
+	size_t count;        // Number of distinct open files
+	size_t *holders;     // Snapshot record indices, grouped by file
+} file_index;
+
+/** @brief Find the slot of a file in the index, or the empty slot it belongs in.
+ *
+ *  @param index - A pointer to the index.
+ *  @param dev - The device containing the file.
+ *  @param inode - The inode number of the file.
+ *  @return A pointer to the slot.
+ */
+file_entry *find_file_slot(file_index *index, dev_t dev, ino_t inode) {
+	size_t i = hash_inode(inode) & (index -> cap - 1);
+	while (index -> slots[i].inode != 0 &&
+		(index -> slots[i].inode != inode || index -> slots[i].dev != dev)) {
+		i = (i + 1) & (index -> cap - 1);
+	}
+	return &index -> slots[i];
+}
+
+/** @brief Build the inode index of a snapshot.
+ *
+ *  Records whose inode is unknown (stat failed) are left out.
+ *
+ *  @param index - A pointer to the index to fill.
+ *  @param snap - A pointer to the snapshot.
+ *  @return Void.
+ */
+void build_file_index(file_index *index, fdt_snapshot *snap) {
+	// Size the table for a load factor of at most one half
+	index -> cap = 16;
+	while (index -> cap < 2 * snap -> fd_count) {
+		index -> cap *= 2;
+	}
+	index -> count = 0;
+	index -> slots = calloc(index -> cap, sizeof(file_entry));
+	index -> holders = malloc((snap -> fd_count + 1) * sizeof(size_t));
+	if (index -> slots == NULL || index -> holders == NULL) {
+		handle_error("Out of memory while indexing open files!");
+	}
+
+	// First pass: count the holders of each file
+	for (size_t i = 0; i < snap -> fd_count; i ++) {
+		if (snap -> inode[i] == 0) {
+			continue;
+		}
+		file_entry *entry = find_file_slot(index, snap -> dev[i], snap -> inode[i]);
+		if (entry -> inode == 0) {
+			entry -> dev = snap -> dev[i];
+			entry -> inode = snap -> inode[i];
+			index -> count ++;
+		}
+		entry -> holders ++;
+	}
+
+	// Give each file a range of the holder array, then fill the ranges in
+	// snapshot order (first is used as the fill cursor and reset afterwards)
+	size_t next = 0;
+	for (size_t i = 0; i < index -> cap; i ++) {
+		index -> slots[i].first = next;
+		next += index -> slots[i].holders;
+	}
+	for (size_t i = 0; i < snap -> fd_count; i ++) {
+		if (snap -> inode[i] != 0) {
+			file_entry *entry = find_file_slot(index, snap -> dev[i], snap -> inode[i]);
+			index -> holders[entry -> first ++] = i;
+		}
+	}
+	for (size_t i = 0; i < index -> cap; i ++) {
+		index -> slots[i].first -= index -> slots[i].holders;
+	}
+}
+
+/** @brief Release the memory held by an inode index.
+ *
+ *  @param index - A pointer to the index.
+ *  @return Void.
+ */
+void free_file_index(file_index *index) {
+	free(index -> slots);
+	free(index -> holders);
+	memset(index, 0, sizeof(*index));
+}
+
+/** @brief Describe both ends of a pipe: the PIDs holding its write and read ends.
+ *
+ *  @param snap - A pointer to the snapshot.
+ *  @param index - A pointer to the inode index of the snapshot.
+ *  @param entry - The pipe's entry in the index.
+ *  @param buf - The buffer to write the description to ("write:12 read:34,56").
+ *  @param size - The size of buf.
+ *  @return Void.
+ */
+void describe_pipe(fdt_snapshot *snap, file_index *index, file_entry *entry, char *buf,
+	size_t size) {
+	const char *ends[2] = {"write:", "read:"};
+	int access[2] = {S_IWUSR, S_IRUSR};
+	size_t len = 0;
+
+	buf[0] = '\0';
+	for (int e = 0; e < 2; e ++) {
+		int last = -1; // Holders are in snapshot order, so a PID's FDs are adjacent
+		const char *sep = ends[e];
+		for (int h = 0; h < entry -> holders && len < size; h ++) {
+			size_t i = index -> holders[entry -> first + h];
+			if (snap -> pid[i] == last || !(snap -> access_mode[i] & access[e])) {
+				continue;
+			}
+			len += snprintf(buf + len, size - len, "%s%s%d", len && sep == ends[e] ? " " : "",
+				sep, snap -> pid[i]);
+			sep = ",";
+			last = snap -> pid[i];
+		}
+	}
+}
+
+/** @brief Annotate the socket and pipe FDs of a snapshot with their endpoints.
+ *
+ *  The socket tables of /proc/net are parsed once into a hash index, so each
+ *  socket FD costs one lookup. Pipe FDs are grouped by inode with the inode
+ *  index, and the access mode of each pipe FD tells which end it holds. Only
+ *  the processes in the snapshot can be named as pipe ends.
+ *
+ *  @param snap - A pointer to the snapshot.
+ *  @param options - A pointer to the scanner options (the proc root).
+ *  @return Void.
+ */
+void resolve_endpoints(fdt_snapshot *snap, const fdt_options *options) {
+	socket_index sockets;
+	file_index index;
+	char desc[PATH_MAX + 128]; // The description of one endpoint
+
+	if (build_socket_index(&sockets, options) != 0) {
+		handle_error("Out of memory while indexing sockets!");
+	}
+	for (size_t i = 0; i < snap -> fd_count; i ++) {
+		if (strncmp(snap -> link[i], "socket:[", 8) != 0) {
+			continue;
+		}
+		const socket_entry *entry = find_socket(&sockets, strtoull(snap -> link[i] + 8, NULL, 10));
+		if (entry != NULL) {
+			format_socket(&sockets, entry, desc, sizeof(desc));
+			if (set_endpoint(snap, i, desc) != 0) {
+				handle_error("Out of memory while building the FD snapshot!");
+			}
+		}
+	}
+	free_socket_index(&sockets);
+
+	// Which end a pipe FD holds was captured with the FDT_FIELD_ACCESS field
+	if (snap -> access_mode == NULL) {
+		return;
+	}
+	build_file_index(&index, snap);
+	for (size_t s = 0; s < index.cap; s ++) {
+		file_entry *entry = &index.slots[s];
+		if (entry -> inode == 0 ||
+			!S_ISFIFO(snap -> mode[index.holders[entry -> first]]) ||
+			strncmp(snap -> link[index.holders[entry -> first]], "pipe:[", 6) != 0) {
+			continue;
+		}
+		describe_pipe(snap, &index, entry, desc, sizeof(desc));
+		for (int h = 0; h < entry -> holders; h ++) {
+			if (set_endpoint(snap, index.holders[entry -> first + h], desc) != 0) {
+				handle_error("Out of memory while building the FD snapshot!");
+			}
+		}
+	}
+	free_file_index(&index);
+}
+
+// The index whose files are being sorted by compare_files (qsort has no context)
+static file_index *sort_index;
+
+/** @brief Compare two files for qsort: most holders first, then by first holder.
+ */
+int compare_files(const void *a, const void *b) {
+	const file_entry *x = *(const file_entry **) a, *y = *(const file_entry **) b;
+	if (x -> holders != y -> holders) {
+		return y -> holders - x -> holders;
+	}
+	size_t fx = sort_index -> holders[x -> first], fy = sort_index -> holders[y -> first];
+	return (fx > fy) - (fx < fy);
+}
+
+/** @brief Print one row of the open-file table.
+ *
+ *  @param out - A pointer to the output buffer.
+ *  @param snap - A pointer to the snapshot.
+ *  @param index - A pointer to the inode index.
+ *  @param entry - A pointer to the file to print.
+ *  @return Void.
+ */
+void print_file(out_buffer *out, fdt_snapshot *snap, file_index *index, file_entry *entry) {
+	out_char(out, '\t');
+	out_int(out, entry -> holders);
+	out_char(out, '\t');
+	out_uint(out, entry -> inode);
+	out_char(out, '\t');
+	out_str(out, snap -> link[index -> holders[entry -> first]]);
+	out_char(out, '\t');
+	for (int h = 0; h < entry -> holders; h ++) {
+		size_t i = index -> holders[entry -> first + h];
+		if (h) {
+			out_char(out, ' ');
+		}
+		out_int(out, snap -> pid[i]);
+		out_char(out, '/');
+		out_int(out, snap -> fd[i]);
+	}
+	out_char(out, '\n');
+}
+
+/** @brief Print the system-wide open-file table: one row per open file.
+ *
+ *  Each row lists how many descriptors hold the file and which (PID/FD) they
+ *  are, sorted by holder count. If an inode or a path is given, only the
+ *  matching files are printed; they are looked up in the index directly.
+ *
+ *  @param snap - A pointer to the snapshot to render.
+ *  @param inode - Only print files with this inode number, or 0 for all files.
+ *  @param path - Only print the file at this path, or NULL for all files.
+ *  @return Void.
+ */
+void show_files(fdt_snapshot *snap, ino_t inode, const char *path) {
+	file_index index;
+	char *line = "\t========================================\n";
+
+	build_file_index(&index, snap);
+	out_buffer *out = out_stdout();
+	out_str(out, "\tHolders\tInode\tFilename\tPID/FD\n");
+	out_str(out, line);
+
+	if (path != NULL) {
+		// Resolve the path to its (device, inode) and look that up
+		struct stat finfo;
+		if (stat(path, &finfo) != 0) {
+			out_flush(out);
+			perror(path);
+		} else {
+			file_entry *entry = find_file_slot(&index, finfo.st_dev, finfo.st_ino);
+			if (entry -> inode != 0 && (inode == 0 || inode == entry -> inode)) {
+				print_file(out, snap, &index, entry);
+			}
+		}
+	} else if (inode != 0) {
+		// Every file with this inode number lies in the same probe sequence
+		for (size_t i = hash_inode(inode) & (index.cap - 1); index.slots[i].inode != 0;
+			i = (i + 1) & (index.cap - 1)) {
+			if (index.slots[i].inode == inode) {
+				print_file(out, snap, &index, &index.slots[i]);
+			}
+		}
+	} else {
+		file_entry **files = malloc((index.count + 1) * sizeof(file_entry *));
+		size_t n = 0;
+		if (files == NULL) {
+			handle_error("Out of memory while indexing open files!");
+		}
+		for (size_t i = 0; i < index.cap; i ++) {
+			if (index.slots[i].inode != 0) {
+				files[n ++] = &index.slots[i];
+			}
+		}
+		sort_index = &index;
+		qsort(files, n, sizeof(file_entry *), compare_files);
+		for (size_t i = 0; i < n; i ++) {
+			print_file(out, snap, &index, files[i]);
+		}
+		free(files);
+	}
+
+	out_str(out, line);
+	out_flush(out);
+	free_file_index(&index);
+}
+
+/** @brief Print the PID and its assigned FD number it the FD number exceed a limit.
+ * 
+ * 	If a threshold is set, the program will display the process ID if and the number
+ *  of open file descriptors for that process if the number of FD assigned to that
+ *  process exceeds the threshold. If top is set, only the top processes with the
+ *  most file descriptors are displayed, sorted, together with their soft limit on
+ *  open files.
+ *
+ *  @param counts - The FD counts of all user-owned processes, in /proc order.
+ *  @param count - The number of counts.
+ *  @param threshold - An integer used to specify a file descriptor limit.
+ *  @param top - The number of processes to report, or -1 to report all of them.
+ *  @param proc_root - The directory the soft limits are read from.
+ *  @return Void.
+ */
+void show_theshold(fd_count *counts, size_t count, int threshold, int top,
+	const char *proc_root) {
+	// If there is a threshold entered, print the process whose number of
+	// file descriptors exceeds that limit
+	if (top == -1) {
+		printf("## Offending processes:\n");
+		for (size_t i = 0; i < count; i ++) {
+			if (counts[i].fd_num > threshold) {
+				printf("%d (%d), ", counts[i].pid, counts[i].fd_num);
+			}
+		}
+		printf("\n");
+		return;
+	}
+
+	// Otherwise keep the top offenders in a bounded heap and print them sorted
+	fd_count *heap = malloc((top > 0 ? top : 1) * sizeof(fd_count));
+	size_t size = 0;
+	if (heap == NULL) {
+		handle_error("Out of memory while ranking file descriptor counts!");
+	}
+	for (size_t i = 0; i < count; i ++) {
+		if (counts[i].fd_num > threshold) {
+			heap_offer(heap, &size, top, counts[i]);
+		}
+	}
+	qsort(heap, size, sizeof(fd_count), compare_counts);
+
+	char *line = "\t========================================\n";
+	printf("## Top %d offending processes:\n\tPID\tFD\tLimit\n%s", top, line);
+	for (size_t i = 0; i < size; i ++) {
+		char limit[32];
+		read_fd_limit(proc_root, heap[i].pid, limit, sizeof(limit));
+		printf("\t%d\t%d\t%s\n", heap[i].pid, heap[i].fd_num, limit);
+	}
+	printf("%s", line);
+	free(heap);
+}
+
+/** @brief Create compositeTable.txt and write the title of its composite table.
+ *
+ *  @param pid - The target process ID, or -1 for all user-owned processes.
+ *  @return A buffer writing to the file (see close_txt), or NULL if the file
+ * 			cannot be created.
+ */
+out_buffer *open_txt(int pid) {
+	// Create a text file to store the output information (write only)
+	int fd = open("compositeTable.txt", O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+
+	// test for files not existing (i.e. open fails)
+	if (fd == -1) {
+		perror("open");
+		return NULL;
+	}
+	out_buffer *out = malloc(sizeof(out_buffer));
+	if (out == NULL) {
+		handle_error("Out of memory while writing compositeTable.txt!");
+	}
+	out -> fd = fd;
+	out -> sink = SINK_TXT;
+	out -> len = 0;
+
+	// Write the title to the file
+	out_str(out, ">>> target PID: ");
+	out_int(out, pid);
+	out_str(out, "\n");
+	out_str(out, table_titles[TABLE_COMPOSITE]);
+	out_str(out, "\t========================================\n");
+	return out;
+}
+
+/** @brief Finish the composite table of compositeTable.txt and close the file.
+ *
+ *  @param out - The buffer returned by open_txt.
+ *  @return Void.
+ */
+void close_txt(out_buffer *out) {
+	out_str(out, "\t========================================\n");
+	out_flush(out);
+	// Close the file after writing
+	close(out -> fd);
+	free(out);
+}
+
+/** @brief Output the composite FD table into a text (ASCII) file.
+ * 
+ * 	If a process ID is provided, the function outputs the composite table for that
+ * 	specific process. Otherwise outputs the composite tables for all processes owned
+ *  by the current user.
+ * 
+ *  @param snap - A pointer to the snapshot to render.
+ *  @param pid - An integer that represents the process ID.
+ *  @return Void.
+ */
+void output_txt(fdt_snapshot *snap, int pid) {
+	out_buffer *out = open_txt(pid);
+	if (out != NULL) {
+		print_rows(out, snap, pid, TABLE_COMPOSITE);
+		close_txt(out);
+	}
+}
+
+/** @brief The header of a binary snapshot file (compositeTable.bin).
+ *
+ *  All integers are stored little-endian. The header is followed by
+ *  record_count fixed-width records and then by the string table, which holds
+ *  each distinct link target once, NUL-terminated.
+ */
+typedef struct {
+	char magic[8];            // BIN_MAGIC
+	uint32_t version;         // BIN_VERSION
+	uint32_t header_size;     // sizeof(bin_header); records start here
+	uint64_t timestamp;       // When the snapshot was taken (seconds since the epoch)
+	uint64_t record_count;    // Number of records
+	uint64_t strings_offset;  // File offset of the string table
+	uint64_t strings_size;    // Size of the string table in bytes
+	int32_t target_pid;       // The target process ID, or -1 for all processes
+	uint32_t reserved;        // Always 0
+	char host[64];            // The host name, NUL-terminated
+	char padding[8];          // Always 0, keeps the records 32-byte aligned
+} bin_header;
+
+/** @brief One file descriptor in a binary snapshot file.
+ */
+typedef struct {
+	int32_t pid;              // The process ID owning the file descriptor
+	int32_t fd;               // The file descriptor number
+	uint64_t dev;             // The device containing the file
+	uint64_t inode;           // The inode number of the file
+	uint32_t mode;            // The file type and mode
+	uint32_t link;            // Offset of the link target in the string table
+} bin_record;
+
+_Static_assert(sizeof(bin_header) == 128, "bin_header must be 128 bytes");
+_Static_assert(sizeof(bin_record) == 32, "bin_record must be 32 bytes");
+
+/** @brief A binary snapshot file mapped into memory (see open_bin_snapshot).
+ */
+typedef struct {
+	void *map;                // The mapped file
+	size_t size;              // The size of the mapping
+	const bin_header *header; // The header at the start of the mapping
+	const bin_record *records; // The records following the header
+	const char *strings;      // The string table
+} bin_snapshot;
+
+/** @brief A binary snapshot file being written record by record (see bin_open).
+ */
+typedef struct {
+	FILE *file;               // The file, positioned after the records written so far
+	const char *path;         // The path of the file, removed if writing it fails
+	string_pool strings;      // The link targets of the records written so far
+	uint64_t count;           // Number of records written
+	int error;                // The errno of the first failed write, or 0
+} bin_writer;
+
+/** @brief Create a binary snapshot file and write a placeholder header.
+ *
+ *  @param writer - A pointer to the writer to initialize.
+ *  @param path - The path of the file.
+ *  @return 0 on success, -1 if the file cannot be created.
+ */
+int bin_open(bin_writer *writer, const char *path) {
+	bin_header header = {
+		.magic = BIN_MAGIC,
+		.version = htole32(BIN_VERSION),
+		.header_size = htole32(sizeof(bin_header)),
+	};
+	memset(writer, 0, sizeof(*writer));
+
+	// Create a binary file to store the output information
+	writer -> file = fopen(path, "wb"); // write only
+	writer -> path = path;
+
+	// test for files not existing (i.e. fopen fails)
+	if (writer -> file == NULL) {
+		perror("fopen");
+		return -1;
+	}
+	if (fwrite(&header, 1, sizeof(header), writer -> file) != sizeof(header)) {
+		writer -> error = errno;
+	}
+	return 0;
+}
+
+/** @brief Append one record of a snapshot, collecting its link target into the
+ *  string table.
+ *
+ *  A failed write, or a string table outgrowing the 32-bit link offsets of
+ *  the records (EFBIG), is kept in the writer and stops the writing; bin_close
+ *  reports it.
+ *
+ *  @param writer - A pointer to the writer.
+ *  @param snap - A pointer to the snapshot.
+ *  @param i - The index of the record.
+ *  @return Void.
+ */
+void bin_write(bin_writer *writer, const fdt_snapshot *snap, size_t i) {
+	if (writer -> error != 0) {
+		return;
+	}
+	size_t link = pool_offset(&writer -> strings, snap -> link[i], strlen(snap -> link[i]));
+	if (link == SIZE_MAX) {
+		handle_error("Out of memory while writing the binary file!");
+	}
+	if (link > UINT32_MAX) {
+		writer -> error = EFBIG;
+		return;
+	}
+	bin_record out = {
+		htole32(snap -> pid[i]), htole32(snap -> fd[i]), htole64(snap -> dev[i]),
+		htole64(snap -> inode[i]), htole32(snap -> mode[i]), htole32(link)
+	};
+	if (fwrite(&out, 1, sizeof(out), writer -> file) != sizeof(out)) {
+		writer -> error = errno;
+		return;
+	}
+	writer -> count ++;
+}
+
+/** @brief Write the string table and the final header, and close the file.
+ *
+ *  If any write failed (a full disk, a string table too large for the
+ *  format), the error is printed and the incomplete file is removed, so no
+ *  corrupt snapshot is left behind.
+ *
+ *  @param writer - A pointer to the writer.
+ *  @param pid - The target process ID, or -1 for all processes.
+ *  @return 0 on success, -1 if the file could not be written.
+ */
+int bin_close(bin_writer *writer, int pid) {
+	bin_header header = {
+		.magic = BIN_MAGIC,
+		.version = htole32(BIN_VERSION),
+		.header_size = htole32(sizeof(bin_header)),
+	};
+	if (writer -> error == 0 && pool_write(&writer -> strings, writer -> file) != 0) {
+		writer -> error = errno;
+	}
+
+	// Fill in the header now that the sizes are known
+	header.timestamp = htole64(time(NULL));
+	header.record_count = htole64(writer -> count);
+	header.strings_offset = htole64(sizeof(header) + writer -> count * sizeof(bin_record));
+	header.strings_size = htole64(writer -> strings.size);
+	header.target_pid = htole32(pid);
+	gethostname(header.host, sizeof(header.host) - 1);
+	if (writer -> error == 0 && (fseek(writer -> file, 0, SEEK_SET) != 0 ||
+		fwrite(&header, 1, sizeof(header), writer -> file) != sizeof(header))) {
+		writer -> error = errno;
+	}
+
+	// Close the file after writing (buffered data is only written now)
+	if (fclose(writer -> file) != 0 && writer -> error == 0) {
+		writer -> error = errno;
+	}
+	pool_free(&writer -> strings);
+	if (writer -> error != 0) {
+		errno = writer -> error;
+		perror(writer -> path);
+		unlink(writer -> path);
+		return -1;
+	}
+	STATS_ADD(stats, bytes[SINK_BINARY],
+		le64toh(header.strings_offset) + le64toh(header.strings_size));
+	return 0;
+}
+
+/** @brief Output the composite FD table into a binary snapshot file.
+ * 
+ * 	If a process ID is provided, the function outputs the composite table for that
+ * 	specific process. Otherwise outputs the composite tables for all processes owned
+ *  by the current user. See bin_header for the file layout.
+ * 
+ *  @param snap - A pointer to the snapshot to render.
+ *  @param pid - An integer that represents the process ID.
+ *  @return 0 on success, -1 if the file could not be written.
+ */
+int output_binary(fdt_snapshot *snap, int pid) {
+	bin_writer writer;
+	if (bin_open(&writer, "compositeTable.bin") != 0) {
+		return -1;
+	}
+	// Write the records after the placeholder header, collecting the link
+	// targets into the string table as we go
+	for (size_t i = 0; i < snap -> fd_count; i ++) {
+		bin_write(&writer, snap, i);
+	}
+	return bin_close(&writer, pid);
+}
+
+/** @brief The sinks of a streamed scan, filled by stream_batch (see stream_tables).
+ */
+typedef struct {
+	int format;            // The table format printed to stdout, or -1 for none
+	int pid;               // The target process ID, or -1 for all user-owned processes
+	int m;                 // The row number of the stdout table
+	int txt_m;             // The row number of compositeTable.txt
+	out_buffer *txt;       // compositeTable.txt, or NULL
+	bin_writer *bin;       // compositeTable.bin, or NULL
+} stream_sinks;
+
+/** @brief Write the records of one process to every sink of a streamed scan.
+ *
+ *  Called by the writer thread of fdt_stream, while the scanner threads
+ *  capture the next processes.
+ *
+ *  @param batch - The records of one process.
+ *  @param arg - A pointer to the stream_sinks.
+ *  @return 0, to continue the stream.
+ */
+int stream_batch(const fdt_snapshot *batch, void *arg) {
+	stream_sinks *sinks = arg;
+	int numbered = sinks -> pid == -1; // Only the tables of all processes number their rows
+	uint64_t start = run_clock();
+	for (size_t p = 0; p < batch -> proc_count; p ++) {
+		const proc_record *proc = &batch -> procs[p];
+		fdt_record rec;
+		size_t end = proc -> first + proc -> fd_num;
+		for (size_t i = proc -> first; i < end; i ++) {
+			fdt_get_record(batch, i, &rec);
+			if (sinks -> format != -1) {
+				if (numbered && sinks -> format < TABLE_CSV) {
+					out_uint(out_stdout(), sinks -> m ++);
+				}
+				renderers[sinks -> format](out_stdout(), &rec);
+			}
+			if (sinks -> txt != NULL) {
+				if (numbered) {
+					out_uint(sinks -> txt, sinks -> txt_m ++);
+				}
+				render_composite(sinks -> txt, &rec);
+			}
+			if (sinks -> bin != NULL) {
+				bin_write(sinks -> bin, batch, i);
+			}
+		}
+	}
+	run_phase(PHASE_TABLES, start);
+	return 0;
+}
+
+/** @brief Print the requested table and exports while /proc is being scanned ("--stream").
+ *
+ *  The rows are the same as without "--stream", but they are written by a
+ *  writer thread as soon as each process is captured, and only the processes
+ *  in the queue are held in memory. Outputs that need the whole snapshot
+ *  first (thresholds, file search, socket resolution, watch mode) are not
+ *  supported, nor is more than one text table.
+ *
+ *  @param scanner - A pointer to the scanner, opened with the options of opt.
+ *  @param opt - A pointer to the validated options.
+ *  @return 0 on success, -1 if compositeTable.bin could not be written.
+ */
+int stream_tables(fdt_scanner *scanner, const fd_options *opt) {
+	// Storing the divided line
+   	char *line = "\t========================================\n";
+	stream_sinks sinks = {-1, opt -> pid, 0, 0, NULL, NULL};
+	bin_writer bin;
+
+	if (opt -> threshold != -1 || opt -> files || opt -> resolve || opt -> watch > 0) {
+		handle_error("--stream cannot be used with --threshold, --top, --files, "
+			"--resolve-sockets or --watch!");
+	}
+	if (opt -> composite + opt -> per_process + opt -> sysWide + opt -> vnode + opt -> fdinfo > 1 &&
+		opt -> format == 0) {
+		handle_error("--stream can only print one table at a time!");
+	}
+
+	// Pick the single table to print, and write its title
+	out_buffer *out = out_stdout();
+	if (opt -> format != 0) {
+		sinks.format = opt -> fdinfo ? opt -> format + TABLE_CSV_FDINFO - TABLE_CSV : opt -> format;
+		if (opt -> format == TABLE_CSV) {
+			out_str(out, opt -> fdinfo ? CSV_FDINFO_HEADER : CSV_HEADER);
+		}
+	} else {
+		sinks.format = opt -> composite ? TABLE_COMPOSITE : opt -> per_process ? TABLE_PER_PROCESS :
+			opt -> sysWide ? TABLE_SYSTEM_WIDE : opt -> vnode ? TABLE_VNODE :
+			opt -> fdinfo ? TABLE_FDINFO : -1;
+		if (sinks.format != -1) {
+			out_str(out, table_titles[sinks.format]);
+			out_str(out, line);
+		}
+	}
+	if (opt -> txt) {
+		sinks.txt = open_txt(opt -> pid);
+	}
+	if (opt -> binary && bin_open(&bin, "compositeTable.bin") == 0) {
+		sinks.bin = &bin;
+	}
+
+	if (fdt_stream(scanner, opt -> pid, opt -> stream, stream_batch, &sinks) == -1) {
+		out_flush(out);
+		scan_failed();
+	}
+
+	if (sinks.format != -1 && opt -> format == 0) {
+		out_str(out, line);
+	}
+	out_flush(out);
+	if (sinks.txt != NULL) {
+		close_txt(sinks.txt);
+	}
+	if (sinks.bin != NULL) {
+		return bin_close(sinks.bin, opt -> pid);
+	}
+	return opt -> binary ? -1 : 0;
+}
+
+/** @brief Map a binary snapshot file into memory and validate it.
+ *
+ *  @param path - The path of the binary snapshot file.
+ *  @param bin - A pointer to the mapped snapshot to fill.
+ *  @return 0 on success, -1 if the file cannot be read or is not a valid
+ * 			snapshot (an error message is printed).
+ */
+int open_bin_snapshot(const char *path, bin_snapshot *bin) {
+	struct stat finfo;
+	memset(bin, 0, sizeof(*bin));
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1 || fstat(fd, &finfo) != 0) {
+		perror(path);
+		if (fd != -1) {
+			close(fd);
+		}
+		return -1;
+	}
+	bin -> size = finfo.st_size;
+	if (bin -> size >= sizeof(bin_header)) {
+		bin -> map = mmap(NULL, bin -> size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+	close(fd);
+	if (bin -> map == NULL || bin -> map == MAP_FAILED) {
+		bin -> map = NULL;
+		printf("'%s' is not a binary FD snapshot!\n", path);
+		return -1;
+	}
+
+	// Check that every part of the file lies within the mapping. Each bound is
+	// checked before it is subtracted from the file size, so a corrupt header
+	// cannot wrap the arithmetic around
+	const bin_header *header = bin -> header = bin -> map;
+	uint64_t count = le64toh(header -> record_count);
+	uint64_t offset = le64toh(header -> strings_offset);
+	uint64_t size = le64toh(header -> strings_size);
+	uint32_t header_size = le32toh(header -> header_size);
+	if (memcmp(header -> magic, BIN_MAGIC, sizeof(header -> magic)) != 0 ||
+		le32toh(header -> version) != BIN_VERSION || header_size < sizeof(bin_header) ||
+		header_size > bin -> size ||
+		count > (bin -> size - header_size) / sizeof(bin_record) ||
+		offset != header_size + count * sizeof(bin_record) || offset > bin -> size ||
+		size > bin -> size - offset ||
+		(size > 0 && ((char *) bin -> map)[offset + size - 1] != '\0')) {
+		printf("'%s' is not a valid binary FD snapshot!\n", path);
+		munmap(bin -> map, bin -> size);
+		bin -> map = NULL;
+		return -1;
+	}
+	bin -> records = (const bin_record *) ((char *) bin -> map + header_size);
+	bin -> strings = (const char *) bin -> map + offset;
+	return 0;
+}
+
+/** @brief Unmap a binary snapshot file.
+ *
+ *  @param bin - A pointer to the mapped snapshot.
+ *  @return Void.
+ */
+void close_bin_snapshot(bin_snapshot *bin) {
+	if (bin -> map != NULL) {
+		munmap(bin -> map, bin -> size);
+	}
+	memset(bin, 0, sizeof(*bin));
+}
+
+/** @brief Read one record of a mapped binary snapshot.
+ *
+ *  @param bin - A pointer to the mapped snapshot.
+ *  @param index - The index of the record.
+ *  @param rec - A pointer to the record to fill; its link points into the mapping.
+ *  @return Void.
+ */
+void read_bin_record(const bin_snapshot *bin, size_t index, fdt_record *rec) {
+	const bin_record *in = &bin -> records[index];
+	uint32_t link = le32toh(in -> link);
+	rec -> pid = (int32_t) le32toh(in -> pid);
+	rec -> fd = (int32_t) le32toh(in -> fd);
+	rec -> dev = le64toh(in -> dev);
+	rec -> inode = le64toh(in -> inode);
+	rec -> mode = le32toh(in -> mode);
+	rec -> link = link < le64toh(bin -> header -> strings_size)
+		? (char *) bin -> strings + link : "";
+	rec -> endpoint = NULL;
+}
+
+/** @brief The record predicates of "--query=FILE" and "--diff OLD NEW".
+ */
+typedef struct {
+	int pid;            // Only the records of this process ("--pid=N"), or -1
+	uint64_t inode;     // Only the records of this inode ("--inode=N"), or 0
+	const char *prefix; // Only the files whose name starts with this ("--path-prefix=P"), or NULL
+	size_t prefix_len;  // The length of prefix
+} record_query;
+
+/** @brief Check whether a record of a mapped binary snapshot matches a query.
+ *
+ *  The fixed-width fields are tested first; the string table is only read
+ *  for a path prefix.
+ *
+ *  @param bin - A pointer to the mapped snapshot.
+ *  @param index - The index of the record.
+ *  @param filter - A pointer to the process filter (only its PID range is used).
+ *  @param query - A pointer to the query.
+ *  @return 1 if the record matches, 0 otherwise.
+ */
+int match_bin_record(const bin_snapshot *bin, size_t index, const fdt_filter *filter,
+	const record_query *query) {
+	const bin_record *in = &bin -> records[index];
+	int pid = (int32_t) le32toh(in -> pid);
+	if (!filter_pid(filter, pid) || (query -> pid != -1 && pid != query -> pid) ||
+		(query -> inode != 0 && le64toh(in -> inode) != query -> inode)) {
+		return 0;
+	}
+	if (query -> prefix != NULL) {
+		uint32_t link = le32toh(in -> link);
+		return link < le64toh(bin -> header -> strings_size) &&
+			strncmp(bin -> strings + link, query -> prefix, query -> prefix_len) == 0;
+	}
+	return 1;
+}
+
+/** @brief Write the records of a mapped binary snapshot that match a query.
+ *
+ *  @param out - The buffer to write to.
+ *  @param bin - A pointer to the mapped snapshot.
+ *  @param filter - A pointer to the process filter.
+ *  @param query - A pointer to the query.
+ *  @param m - The number of the first row, or -1 for no row numbers.
+ *  @param render - The row renderer.
+ *  @return Void.
+ */
+void dump_records(out_buffer *out, const bin_snapshot *bin, const fdt_filter *filter,
+	const record_query *query, int m, row_renderer render) {
+	uint64_t count = le64toh(bin -> header -> record_count);
+	for (uint64_t i = 0; i < count; i ++) {
+		fdt_record rec;
+		if (match_bin_record(bin, i, filter, query)) {
+			read_bin_record(bin, i, &rec);
+			if (m != -1) {
+				out_uint(out, m ++);
+			}
+			render(out, &rec);
+		}
+	}
+}
+
+/** @brief Print the composite table stored in a binary snapshot file.
+ *
+ *  The file is memory-mapped and read in place; only records whose PID passes
+ *  the filter's PID range and that match the query are printed.
+ *
+ *  @param path - The path of the binary snapshot file.
+ *  @param filter - A pointer to the process filter.
+ *  @param query - A pointer to the query ("--query=FILE").
+ *  @param format - TABLE_CSV or TABLE_JSONL to print the records in that format
+ * 				    instead of the composite table, or 0.
+ *  @return 0 on success, -1 on error.
+ */
+int dump_binary(const char *path, const fdt_filter *filter, const record_query *query,
+	int format) {
+	bin_snapshot bin;
+	char when[64];   // The formatted timestamp of the snapshot
+	char *line = "\t========================================\n";
+
+	if (open_bin_snapshot(path, &bin) != 0) {
+		return -1;
+	}
+	time_t timestamp = le64toh(bin.header -> timestamp);
+	int pid = (int32_t) le32toh(bin.header -> target_pid);
+	if (format == TABLE_CSV || format == TABLE_JSONL) {
+		out_buffer *out = out_stdout();
+		if (format == TABLE_CSV) {
+			out_str(out, CSV_HEADER);
+		}
+		dump_records(out, &bin, filter, query, -1, renderers[format]);
+		out_flush(out);
+		close_bin_snapshot(&bin);
+		return 0;
+	}
+	strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&timestamp));
+	printf(">>> snapshot of %.64s at %s\n>>> target PID: %d\n", bin.header -> host,
+		when, pid);
+	printf("\tPID\tFD\tFilename\t\tInode\n%s", line);
+
+	// Number rows like the text table does
+	out_buffer *out = out_stdout();
+	dump_records(out, &bin, filter, query, pid == -1 ? 0 : -1, render_composite);
+	out_str(out, line);
+	out_flush(out);
+	close_bin_snapshot(&bin);
+	return 0;
+}
+
+/** @brief Compare two records of binary snapshots by (pid, fd, dev, inode).
+ *
+ *  @param a - A pointer to the first record.
+ *  @param b - A pointer to the second record.
+ *  @return A negative, zero or positive value like strcmp.
+ */
+static inline int compare_bin_keys(const bin_record *a, const bin_record *b) {
+	int32_t pa = le32toh(a -> pid), pb = le32toh(b -> pid);
+	int32_t fa = le32toh(a -> fd), fb = le32toh(b -> fd);
+	uint64_t da = le64toh(a -> dev), db = le64toh(b -> dev);
+	uint64_t ia = le64toh(a -> inode), ib = le64toh(b -> inode);
+	if (pa != pb) {
+		return (pa > pb) - (pa < pb);
+	}
+	if (fa != fb) {
+		return (fa > fb) - (fa < fb);
+	}
+	if (da != db) {
+		return (da > db) - (da < db);
+	}
+	return (ia > ib) - (ia < ib);
+}
+
+/** @brief Compare two record indices of a binary snapshot for qsort_r.
+ *
+ *  @param a - A pointer to the first index.
+ *  @param b - A pointer to the second index.
+ *  @param bin - The snapshot (a const bin_snapshot *) the indices refer to.
+ *  @return A negative, zero or positive value like strcmp.
+ */
+int compare_bin_order(const void *a, const void *b, void *bin) {
+	const bin_record *records = ((const bin_snapshot *) bin) -> records;
+	return compare_bin_keys(&records[*(const uint32_t *) a], &records[*(const uint32_t *) b]);
+}
+
+/** @brief Order the records of a mapped binary snapshot by (pid, fd, dev, inode).
+ *
+ *  Snapshots are written in /proc order, grouped by ascending PID with
+ *  ascending FDs, so the records are usually sorted already and nothing is
+ *  allocated. Otherwise only a permutation of 4-byte indices is built; the
+ *  records stay in the mapping.
+ *
+ *  @param bin - A pointer to the mapped snapshot.
+ *  @return The sorted indices, or NULL if the records are in order.
+ */
+uint32_t *sort_bin_records(const bin_snapshot *bin) {
+	uint64_t count = le64toh(bin -> header -> record_count);
+	uint64_t i = 1;
+	while (i < count && compare_bin_keys(&bin -> records[i - 1], &bin -> records[i]) <= 0) {
+		i ++;
+	}
+	if (i >= count) {
+		return NULL;
+	}
+	if (count > UINT32_MAX) {
+		handle_error("The binary snapshot has too many records to sort!");
+	}
+
+	uint32_t *order = malloc(count * sizeof(uint32_t));
+	if (order == NULL) {
+		handle_error("Out of memory while sorting a binary snapshot!");
+	}
+	for (i = 0; i < count; i ++) {
+		order[i] = i;
+	}
+	qsort_r(order, count, sizeof(uint32_t), compare_bin_order, (void *) bin);
+	return order;
+}
+
+/** @brief Write one row of a snapshot difference.
+ *
+ *  @param out - The buffer to write to.
+ *  @param rec - A pointer to the record.
+ *  @param change - '+' for an FD only in the new snapshot, '-' for one only in the old.
+ *  @param format - TABLE_CSV, TABLE_JSONL or 0 for the composite table.
+ *  @return Void.
+ */
+void render_change(out_buffer *out, const fdt_record *rec, char change, int format) {
+	if (format == TABLE_CSV) {
+		out_char(out, change);
+		out_char(out, ',');
+		render_csv(out, rec);
+	} else if (format == TABLE_JSONL) {
+		out_str(out, change == '+' ? "{\"change\":\"+\"," : "{\"change\":\"-\",");
+		out_json_fields(out, rec);
+		out_str(out, "}\n");
+	} else {
+		out_char(out, change);
+		render_composite(out, rec);
+	}
 }
 
-/** @brief Print the FD table with a specific format of a process with the given pid.
- * 
- * 	The function opens the file descriptor directory for the given process and reads
- *  each file descriptor in the directory. Then it displays or outputs those information
- *  in the requested format.
- * 	
- *  @param pid - An integer that represents the process ID of the given files
- *  @param threshold - An integer used to specify a file descriptor limit.
- * 					   If a limit is set and the number of open file descriptors
- * 					   of the process exceeds that limit, the program will only
- * 					   display the process ID and the number of open file descriptors.
- *  @param m - A pointer to an integer used to track the total number of open FDs.
- *  @param per_process - An integer flag to indicate whether the output is displayed
- * 					   in per-process format.
- *  @param sysWide - An integer flag to indicate whether the output is displayed in
- * 				       system-wide format.
- *  @param vnode - An integer flag to indicate whether the output is displayed in
- * 				       vnode format.
- *  @param composite - An integer flag to indicate whether the output is displayed in
- * 					   composite format.
- *  @param output_txt - A FILE pointer to a text file which storing the text output
- * 				   	   for the composite table.
- *  @param output_binary - A FILE pointer to a binary file which storing the binary
- * 				       output for the composite table.
- *  @return Void.
- */
-void show_FD(int pid, int threshold, int *m, int per_process, int sysWide, int vnode,
-	int composite, FILE *output_txt, FILE *output_binary) {
-	DIR *dir;                  // A pointer to a dictionary
-    struct dirent *dir_entry;  // A dictionary entry variable
-    struct stat finfo;         // A variable to store file information
-    int fd_num = 0;  // A integer storing the number of file descriptors of the process
-    char d_path[50]; // A string indicating the path to the /proc/[PID]/fd directory
-    sprintf(d_path, "/proc/%d/fd", pid);
-
-    // If cannot open the dictionary, the function returns
-    if ((dir = opendir(d_path)) == NULL){
-        return;
-    }
-
-    // Loop the /proc/[PID]/fd directory to get each file descriptor's information
-    while ((dir_entry = readdir(dir)) != NULL) {
-    	// If the file name is a digit (not . or ..)
-        if (isdigit(dir_entry -> d_name[0]) > 0) {
-	        // Create a path to that subdictionary (i.e. the file descripor)
-	        char path[50];
-	    	sprintf(path, "/proc/%d/fd/%d", pid, atoi(dir_entry -> d_name));
-
-	    	// Get entry's information. If error, print a message
-	        if(stat(path, &finfo) != 0) {
-	        	perror("stat");
-	        }
-
-	        char link[256]; // A variable storing the file name
-	   		ssize_t r;      // A variable storing the link size
-
-	   		// If r < 0, an error occurs with the readlink() function
- 			if ((r = readlink(path, link, 50)) < 0) {
-			    perror("readlink");
-			}
-
-			// readlink() does not append a terminating null byte to link,
-			// So we manually add a terminating null to link
-	   		link[50] = '\0';
-
-	   		// Create a string storing the composite output information
-			char info[1024];
-
-	   		// Print how many output since now
-	   		if (*m != -1 && threshold == -1 && !output_txt && !output_binary) {
-		   		printf("%d", *m);
-		   	} else if (*m != -1 && (output_txt || output_binary)) {
-		   		sprintf(info, "%d\t%d\t%s\t%s\t%ld\n", *m, pid, dir_entry -> d_name,
-		   			link, finfo.st_ino);
-		   	} else {
-		   		sprintf(info, "\t%d\t%s\t%s\t%ld\n", pid, dir_entry -> d_name, link,
-		   			finfo.st_ino);
-		   	}
-
-		   	// Display the information in the request format
-		   	// (including output into files)
-	   		if (composite == 1) {
-	   			printf("\t%d\t%s\t%s\t%ld\n", pid, dir_entry -> d_name, link, finfo.st_ino);
-			}
-			if (per_process == 1) {
-				printf("\t%d\t%s\n", pid, dir_entry -> d_name);
-			}
-			if (sysWide == 1) {
-				printf("\t%d\t%s\t%s\n", pid, dir_entry -> d_name, link);
-			}
-			if (vnode == 1) {
-				printf("\t%s\t%ld\n", dir_entry -> d_name, finfo.st_ino);
-			}
-			if (output_txt) {
-				// write to the file
-				fprintf(output_txt, "%s", info);
-			}
-			if (output_binary) {
-				// write to the file
-				fwrite(info, 1, sizeof(info), output_binary);
-			}
+/** @brief Print the file descriptors opened and closed between two binary snapshots.
+ *
+ *  Both files are memory-mapped and joined with a sort-merge on (pid, fd,
+ *  dev, inode): a record only in the new snapshot is an FD opened since the
+ *  old one (a leak candidate, "+"), a record only in the old snapshot is an
+ *  FD that was closed ("-"). Only the records that match the query on either
+ *  side take part in the join.
+ *
+ *  @param old_path - The path of the older binary snapshot file.
+ *  @param new_path - The path of the newer binary snapshot file.
+ *  @param filter - A pointer to the process filter (only its PID range is used).
+ *  @param query - A pointer to the query.
+ *  @param format - TABLE_CSV or TABLE_JSONL, or 0 for the composite table.
+ *  @return 0 on success, -1 on error.
+ */
+int diff_binary(const char *old_path, const char *new_path, const fdt_filter *filter,
+	const record_query *query, int format) {
+	bin_snapshot old, new;
+	const char *paths[2] = {old_path, new_path};
+	const bin_snapshot *bins[2] = {&old, &new};
 
-			if (*m != -1) {
-				*m = *m + 1;
-			}
+	if (open_bin_snapshot(old_path, &old) != 0) {
+		return -1;
+	}
+	if (open_bin_snapshot(new_path, &new) != 0) {
+		close_bin_snapshot(&old);
+		return -1;
+	}
+	if (format == 0) {
+		for (int k = 0; k < 2; k ++) {
+			char when[64]; // The formatted timestamp of the snapshot
+			time_t timestamp = le64toh(bins[k] -> header -> timestamp);
+			strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&timestamp));
+			printf(">>> %s: %s, snapshot of %.64s at %s\n", k ? "new" : "old", paths[k],
+				bins[k] -> header -> host, when);
+		}
+		printf("\tPID\tFD\tFilename\t\tInode\n\t========================================\n");
+	}
 
-			// Count how many file descriptors in this process
-	        fd_num ++;
-    	}
-    }
+	uint32_t *old_order = sort_bin_records(&old), *new_order = sort_bin_records(&new);
+	uint64_t old_count = le64toh(old.header -> record_count);
+	uint64_t new_count = le64toh(new.header -> record_count);
+	uint64_t i = 0, j = 0, opened = 0, closed = 0;
+	out_buffer *out = out_stdout();
+	if (format == TABLE_CSV) {
+		out_str(out, DIFF_CSV_HEADER);
+	}
+	while (i < old_count || j < new_count) {
+		size_t oi = old_order != NULL && i < old_count ? old_order[i] : i;
+		size_t nj = new_order != NULL && j < new_count ? new_order[j] : j;
+		if (i < old_count && !match_bin_record(&old, oi, filter, query)) {
+			i ++;
+			continue;
+		}
+		if (j < new_count && !match_bin_record(&new, nj, filter, query)) {
+			j ++;
+			continue;
+		}
 
-    // Display the process and the number of FD assigned if the threshold
-    // flag is not -1 and fd_num > threshold
-    if (threshold != -1 && fd_num > threshold) {
-    	printf("%d (%d), ", pid, fd_num);
-    }
+		fdt_record rec;
+		int cmp = i == old_count ? 1 : j == new_count ? -1 :
+			compare_bin_keys(&old.records[oi], &new.records[nj]);
+		if (cmp == 0) {
+			i ++;
+			j ++;
+		} else if (cmp < 0) {
+			read_bin_record(&old, oi, &rec);
+			render_change(out, &rec, '-', format);
+			closed ++;
+			i ++;
+		} else {
+			read_bin_record(&new, nj, &rec);
+			render_change(out, &rec, '+', format);
+			opened ++;
+			j ++;
+		}
+	}
+	if (format == 0) {
+		out_str(out, ">>> ");
+		out_uint(out, opened);
+		out_str(out, " opened, ");
+		out_uint(out, closed);
+		out_str(out, " closed\n");
+	}
+	out_flush(out);
 
-    // Close the dictionary
-    closedir(dir);
+	free(old_order);
+	free(new_order);
+	close_bin_snapshot(&old);
+	close_bin_snapshot(&new);
+	return 0;
 }
 
-/** @brief Loop the /proc directory to find processes owned by the current user.
- * 
- * 	The function opens the /proc directory and reads each directory in the directory.
- *  If a directory name is a number (represents a PID), the function checks whether
- *  the process owner is the current user. If it is, the function calls the show_FD
- *  function on that process ID, to display the FD tables in a given format.
- * 
- *  @param threshold - An integer used to specify a file descriptor limit.
- *  @param per_process - An integer flag to indicate whether the output is displayed
- * 				     in per-process format.
- *  @param sysWide - An integer flag to indicate whether the output is displayed in
- * 				     system-wide format.
- *  @param vnode - An integer flag to indicate whether the output is displayed in
- * 				     vnode format.
- *  @param composite - An integer flag to indicate whether the output is displayed in
- * 					 composite format.
- *  @param output_txt - A FILE pointer to a text file which storing the text output
- * 					 for the composite table.
- *  @param output_binary - A FILE pointer to a binary file which storing the binary
- * 				     output for the composite table.
- *  @return Void.
- */
-void find_files(int threshold, int per_process, int sysWide, int vnode, int composite,
-	FILE *output_txt, FILE *output_binary) {
-	DIR *dir;                      // A pointer to a dictionary
-	struct dirent *dir_entry;      // A variable to store dictionary entry
-    int m = 0;                     // Track the number of total FDs
-
-    // Open the /proc directory. If fails, print an message.
-    if ((dir = opendir("/proc")) == NULL){
-        perror("opendir");
-    }
-
-    // recursively opening subdirectories until you find a valid inode number
-    while ((dir_entry = readdir(dir)) != NULL) {
-    	// Check if the directory name is a number (i.e. PID)
-    	if (isdigit(dir_entry -> d_name[0]) > 0) {
-	    	int uid = getuid();      // Get the current user id
-	    	int uid_cur;             // To store the user id information
-	    	char path[50];           // To store path to the desired dictionary
-	    	char line[256];          // To store each line when reading files
-	    	FILE *fp;                // A file pointer to "/proc/[PID]/status"
-
-	    	sprintf(path, "/proc/%d/status", atoi(dir_entry -> d_name));
-
-	    	// Open the "/proc/[PID]/status" file for each process
-	    	if ((fp = fopen(path, "r")) == NULL) {
-	    		perror("fp");
-	    	}
-
-			// Check if the process owner is the current user
-	    	while (fgets(line, sizeof(line), fp)) {
-	    		// Get the process owner's UID
-	            if (sscanf(line, "Uid: %d", &uid_cur)) {
-	            	// If the process owner is the current user, display the FD
-	            	// tables for the process (i.e. call show_FD)
-	                if ((int) uid == uid_cur) {
-	                    show_FD(atoi(dir_entry -> d_name), threshold,
-	                    	&m, per_process, sysWide, vnode, composite,
-	                    	output_txt, output_binary);
-	                }
-	            }
-	        }
-	        // Close the file after we done
-	        fclose(fp);
-    	}
-    }
-    // Close the dictionary
-    closedir(dir);
+/** @brief Compare two process records by PID for qsort and bsearch.
+ */
+int compare_procs(const void *a, const void *b) {
+	const proc_record *x = a, *y = b;
+	return (x -> pid > y -> pid) - (x -> pid < y -> pid);
 }
 
-/** @brief Print the FD table with a specific format of a process with the given pid.
- * 
- * 	The function sets the default behaviour if no argument is passed to the program
- *  to display the composite table. If a process ID is provided, the function will
- *  display the file descriptors of that process in the requested format. If no process
- * 	ID provided, the function will display the FD tables for all processes owned by the
- *  current user in the requested format.
- * 
- *  @param pid - An integer that represents the process ID.
- * 	             If -1 is passed as an argument, the program will list the open files
- *               of all processes owned by the current user. Otherwise it will display
- *               the FD tables for the specified process.
- *  @param per_process - An integer flag to indicate whether the program will display
- * 					     a per-process format table.
- *  @param sysWide - An integer flag to indicate whether the program will display a
- * 				     system-wide format table.
- *  @param vnode - An integer flag to indicate whether the program will display a
- * 				   vnode format table.
- *  @param composite - An integer flag to indicate whether the program will display a
- * 					   composite format table.
- *  @return Void.
+/** @brief Print the opened and closed file descriptors of one process.
+ *
+ *  Both record lists must be sorted by FD number. An FD whose file changed is
+ *  reported as closed and opened again.
+ *
+ *  @param prev - The snapshot of the previous refresh.
+ *  @param old_first - The index of the process' first record in prev.
+ *  @param old_num - The number of old records (0 if the process is new).
+ *  @param next - The snapshot of this refresh.
+ *  @param new_first - The index of the process' first record in next.
+ *  @param new_num - The number of new records (0 if the process has exited).
+ *  @param out - The buffer to write to.
+ *  @return The number of printed deltas.
  */
-void show_tables(int pid, int per_process, int sysWide, int vnode, int composite) {
-	int m = -1;
+int print_deltas(const fdt_snapshot *prev, size_t old_first, int old_num,
+	const fdt_snapshot *next, size_t new_first, int new_num, out_buffer *out) {
+	int i = 0, j = 0, deltas = 0;
+	fdt_record o, n;
+	while (i < old_num || j < new_num) {
+		size_t oi = old_first + i, ni = new_first + j;
+		if (i < old_num && j < new_num && prev -> fd[oi] == next -> fd[ni]) {
+			// Interned links differ from pool to pool, so compare the strings
+			if (prev -> inode[oi] != next -> inode[ni] || prev -> dev[oi] != next -> dev[ni] ||
+				strcmp(prev -> link[oi], next -> link[ni]) != 0) {
+				fdt_get_record(prev, oi, &o);
+				fdt_get_record(next, ni, &n);
+				render_closed(out, &o);
+				render_opened(out, &n);
+				deltas += 2;
+			}
+			i ++;
+			j ++;
+		} else if (j == new_num || (i < old_num && prev -> fd[oi] < next -> fd[ni])) {
+			fdt_get_record(prev, oi, &o);
+			render_closed(out, &o);
+			deltas ++;
+			i ++;
+		} else {
+			fdt_get_record(next, ni, &n);
+			render_opened(out, &n);
+			deltas ++;
+			j ++;
+		}
+	}
+	return deltas;
+}
 
-	// Default behaviour: if no argument is passed to the program,
-	// the program will display the composite table
-	if (per_process == 0 && sysWide == 0 && vnode == 0 && composite == 0) {
-		composite = 1;
+/** @brief Check whether the fd directory of a process still lists the same FDs.
+ *
+ *  Only the directory entries are enumerated; nothing is stat'ed or readlink'ed.
+ *
+ *  @param pid_dir - A file descriptor of the /proc/[PID] directory.
+ *  @param fds - The FD numbers of the previous refresh, in ascending order.
+ *  @param fd_num - The number of FDs.
+ *  @param reader - A reader whose buffer is reused for the enumeration.
+ *  @return 1 if the same FD numbers are open, 0 otherwise.
+ */
+int same_fd_list(int pid_dir, const int *fds, int fd_num, dent_reader *reader) {
+	const char *name;
+	int count = 0, same = 1;
+	reader -> fd = openat(pid_dir, "fd", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (reader -> fd == -1) {
+		return 0;
+	}
+	reader -> len = reader -> pos = 0;
+	while (same && (name = next_dent(reader)) != NULL) {
+		// The kernel lists FDs in ascending order, so compare position by position
+		same = count < fd_num && fds[count] == atoi(name);
+		count ++;
 	}
+	close(reader -> fd);
+	return same && count == fd_num;
+}
 
-	// Storing the divided line
-   	char *line = "\t========================================\n";
+/** @brief Refresh a snapshot and print what changed since the previous one.
+ *
+ *  A process whose start time and list of FD numbers are unchanged is not
+ *  rescanned: its records are moved over from the previous snapshot. Every other
+ *  process is rescanned with show_FD and diffed against its previous records.
+ *  Note that an FD number that is closed and reopened between two refreshes is
+ *  only noticed if the list of FD numbers changed as well.
+ *
+ *  @param prev - A pointer to the previous snapshot (its procs sorted by PID and
+ * 				  each process' records sorted by FD). Records moved to next are
+ * 				  cleared in prev.
+ *  @param next - A pointer to an empty snapshot to fill.
+ *  @param options - A pointer to the scanner options.
+ *  @param rescanned - A pointer to store the number of rescanned processes.
+ *  @param out - The buffer the deltas are written to.
+ *  @return The number of printed deltas.
+ */
+int watch_refresh(fdt_snapshot *prev, fdt_snapshot *next, const fdt_options *options,
+	size_t *rescanned, out_buffer *out) {
+	int pid;
+	size_t index = 0; // The position in the PID set
+	int deltas = 0;
+	char *seen = calloc(prev -> proc_count + 1, 1); // Which previous processes still exist
+	dent_reader *procs = malloc(sizeof(dent_reader));
+	dent_reader *fds = malloc(sizeof(dent_reader));
+	if (seen == NULL || procs == NULL || fds == NULL) {
+		handle_error("Out of memory while refreshing the FD snapshot!");
+	}
+	*rescanned = 0;
+	next -> fields = prev -> fields; // Carried-over records keep their columns
+	next -> uring_failed = prev -> uring_failed;
 
-	// Given the flags' value, display the FD tables in all requested formats
-	// for the process with PID pid by passing different flag values to the
-	// function show_FD. If no PID is presented by the user, call find_files
-	// to get all user-owned processes.
-	if (composite == 1) { // If the composite flag is on
-		printf("\tPID\tFD\tFilename\t\tInode\n%s", line); // Print the title information
-		if (pid != - 1) { // If a specific PID given
-			show_FD(pid, -1, &m, 0, 0, 0, 1, NULL, NULL);
-		} else {          // Otherwise display FD tables for all processes
-			find_files(-1, 0, 0, 0, 1, NULL, NULL);
+	procs -> fd = open_proc_root(options);
+	procs -> len = procs -> pos = 0;
+	while (procs -> fd != -1 && (pid = next_pid(procs, options, &index)) != -1) {
+		if (!filter_process(options, procs -> fd, pid)) {
+			continue;
 		}
-		printf("%s", line); // Print the divided line
-	}
-	if (per_process == 1) {
-		printf("\tPID\tFD\n%s", line);
-		if (pid != - 1) {
-			show_FD(pid, -1, &m, 1, 0, 0, 0, NULL, NULL);
+		int pid_dir = open_pid_dir(procs -> fd, pid, options);
+		if (pid_dir == -1) {
+			continue;
+		}
+		uint64_t starttime = read_starttime(pid_dir);
+		proc_record key = {pid, 0, 0, 0};
+		proc_record *old = bsearch(&key, prev -> procs, prev -> proc_count,
+			sizeof(proc_record), compare_procs);
+		if (old != NULL && old -> starttime == starttime) {
+			seen[old - prev -> procs] = 1;
 		} else {
-			find_files(-1, 1, 0, 0, 0, NULL, NULL);
+			old = NULL; // A new process, or a reused PID
 		}
-		printf("%s", line);
-	}
-	if (sysWide == 1) {
-		printf("\tPID\tFD\tFilename\n%s", line);
-		if (pid != - 1) {
-			show_FD(pid, -1, &m, 0, 1, 0, 0, NULL, NULL);
+
+		if (old == NULL && pid == getpid()) {
+			close(pid_dir);
+			continue;
+		}
+		if (old != NULL && (pid == getpid() ||
+			same_fd_list(pid_dir, &prev -> fd[old -> first], old -> fd_num, fds))) {
+			// Nothing indicates a change: copy the previous records over. This
+			// program's own descriptors change while it scans, so they are
+			// never rescanned.
+			if (grow_array((void **) &next -> procs, &next -> proc_cap, next -> proc_count,
+				sizeof(proc_record)) != 0) {
+				handle_error("Out of memory while refreshing the FD snapshot!");
+			}
+			proc_record *proc = &next -> procs[next -> proc_count ++];
+			*proc = *old;
+			proc -> first = next -> fd_count;
+			for (int i = 0; i < old -> fd_num; i ++) {
+				fdt_record rec;
+				fdt_get_record(prev, old -> first + i, &rec);
+				if (add_record(next, &rec) != 0) {
+					handle_error("Out of memory while refreshing the FD snapshot!");
+				}
+			}
 		} else {
-			find_files(-1, 0, 1, 0, 0, NULL, NULL);
+			size_t before = next -> proc_count;
+			if (show_FD(pid, pid_dir, options, next) != 0) {
+				handle_error("Out of memory while refreshing the FD snapshot!");
+			}
+			(*rescanned) ++;
+			if (next -> proc_count > before) {
+				proc_record *proc = &next -> procs[before];
+				proc -> starttime = starttime;
+				if (sort_records(next, proc -> first, proc -> fd_num) != 0) {
+					handle_error("Out of memory while refreshing the FD snapshot!");
+				}
+				deltas += print_deltas(prev, old ? old -> first : 0, old ? old -> fd_num : 0,
+					next, proc -> first, proc -> fd_num, out);
+			}
 		}
-		printf("%s", line);
+		close(pid_dir);
 	}
-	if (vnode == 1) {
-		printf("\tFD\tInode\n%s", line);
-		if (pid != - 1) {
-			show_FD(pid, -1, &m, 0, 0, 1, 0, NULL, NULL);
-		} else {
-			find_files(-1, 0, 0, 1, 0, NULL, NULL);
+	if (procs -> fd != -1) {
+		close(procs -> fd);
+	}
+
+	// Every FD of a process that has exited (or whose PID was reused) is closed
+	for (size_t p = 0; p < prev -> proc_count; p ++) {
+		if (!seen[p]) {
+			deltas += print_deltas(prev, prev -> procs[p].first, prev -> procs[p].fd_num,
+				next, 0, 0, out);
 		}
-		printf("%s", line);
 	}
+
+	qsort(next -> procs, next -> proc_count, sizeof(proc_record), compare_procs);
+	free(fds);
+	free(procs);
+	free(seen);
+	return deltas;
 }
 
-/** @brief Print the PID and its assigned FD number it the FD number exceed a limit.
- * 
- * 	If a threshold is set, the program will display the process ID if and the number
- *  of open file descriptors for that process if the number of FD assigned to that
- *  process exceeds the threshold.
+/** @brief Refresh the FD tables every interval and print only what changed.
  *
- *  @param threshold - An integer used to specify a file descriptor limit.
+ *  The loop runs until the program is interrupted. Each refresh prints one
+ *  line per opened ("+") or closed ("-") file descriptor.
+ *
+ *  @param snap - A pointer to the snapshot already displayed; it is reused as
+ * 				  the first previous snapshot.
+ *  @param options - A pointer to the scanner options.
+ *  @param interval - The number of seconds between refreshes.
  *  @return Void.
  */
-void show_theshold(int threshold) {
-	// If there is a threshold entered, print the process whose number of
-	// file descriptors exceeds that limit
-	printf("## Offending processes:\n");
-	find_files(threshold, 0, 0, 0, 0, NULL, NULL);
-	printf("\n");
+void watch_files(fdt_snapshot *snap, const fdt_options *options, double interval) {
+	struct timespec delay = {(time_t) interval,
+		(long) ((interval - (time_t) interval) * 1e9)};
+
+	// Prepare the displayed snapshot for diffing: look up the start time of
+	// each process and sort the processes by PID and their records by FD
+	int proc_fd = open_proc_root(options);
+	for (size_t p = 0; p < snap -> proc_count; p ++) {
+		proc_record *proc = &snap -> procs[p];
+		int pid_dir = open_pid_dir(proc_fd, proc -> pid, options);
+		proc -> starttime = pid_dir != -1 ? read_starttime(pid_dir) : 0;
+		if (pid_dir != -1) {
+			close(pid_dir);
+		}
+		if (sort_records(snap, proc -> first, proc -> fd_num) != 0) {
+			handle_error("Out of memory while refreshing the FD snapshot!");
+		}
+	}
+	if (proc_fd != -1) {
+		close(proc_fd);
+	}
+	qsort(snap -> procs, snap -> proc_count, sizeof(proc_record), compare_procs);
+	fflush(stdout);
+
+	// The two snapshots take turns, so each refresh reuses the columns and the
+	// string arena of the one before the previous
+	fdt_snapshot next = {0};
+	while (1) {
+		nanosleep(&delay, NULL);
+
+		char when[32];       // The formatted time of the refresh
+		time_t now = time(NULL);
+		size_t rescanned;
+
+		strftime(when, sizeof(when), "%H:%M:%S", localtime(&now));
+		printf(">>> refresh at %s\n", when);
+		out_buffer *out = out_stdout();
+		clear_snapshot(&next);
+		watch_refresh(snap, &next, options, &rescanned, out);
+		out_flush(out);
+		printf(">>> %zu processes, %zu rescanned\n", next.proc_count, rescanned);
+		fflush(stdout);
+
+		fdt_snapshot tmp = *snap;
+		*snap = next;
+		next = tmp;
+	}
 }
 
-/** @brief Output the composite FD table into a text (ASCII) file.
- * 
- * 	If a process ID is provided, the function outputs the composite table for that
- * 	specific process. Otherwise outputs the composite tables for all processes owned
- *  by the current user.
- * 
- *  @param pid - An integer that represents the process ID.
- *  @return Void.
+/** @brief One sample of the FD count of a process.
  */
-void output_txt(int pid) {
-	int m = -1;
+typedef struct {
+	double time;     // When the sample was taken (seconds on the monotonic clock)
+	int fd_num;      // The number of file descriptors
+} fd_sample;
 
-	// Storing the divided line
-   	char *line = "\t========================================\n";
+/** @brief The last samples of the FD count of one process ("--leak-watch=").
+ *
+ *  A process is identified by its PID and start time, so a reused PID starts
+ *  a new history. The samples are kept in a ring of a fixed size, so a tracked
+ *  process costs the same memory however long it runs.
+ */
+typedef struct {
+	int pid;             // The process ID
+	uint64_t starttime;  // The start time of the process (see read_starttime)
+	size_t next;         // Where the next sample goes in ring
+	size_t count;        // The number of samples in ring (at most the window)
+	fd_sample *ring;     // The samples, oldest first from next once the ring is full
+} fd_history;
 
-	// Create a text file to store the output information
-	FILE *output_txt = fopen("compositeTable.txt", "w"); // write only
+/** @brief Compare two histories by PID for qsort and bsearch.
+ */
+int compare_histories(const void *a, const void *b) {
+	int x = ((const fd_history *) a) -> pid, y = ((const fd_history *) b) -> pid;
+	return (x > y) - (x < y);
+}
 
-	// test for files not existing (i.e. fopen fails)
-	if (output_txt == NULL) {
-		perror("fopen");
+/** @brief Compute the growth rate of a history with a least-squares fit.
+ *
+ *  Every sample of the window weighs the same, so a single burst of opened
+ *  FDs moves the slope less than a steady leak.
+ *
+ *  @param history - A pointer to the history.
+ *  @return The slope in FDs per second, or 0 with fewer than two samples.
+ */
+double history_slope(const fd_history *history) {
+	double mean_t = 0, mean_n = 0, cov = 0, var = 0;
+	size_t n = history -> count;
+	if (n < 2) {
+		return 0;
 	}
-
-	// Write the title to the file
-	fprintf(output_txt, ">>> target PID: %d\n\tPID\tFD\tFilename\t\tInode\n%s",
-		pid, line);
-	if (pid != -1) {
-		// Pass the file pointer to show_FD to write the FD information
-		show_FD(pid, -1, &m, 0, 0, 0, 0, output_txt, NULL);
-	} else {
-		// Pass the file pointer to find_files and let find_files loop each
-		// process then call show_FD to write the FD information
-		find_files(-1, 0, 0, 0, 0, output_txt, NULL);
+	// Times are taken relative to a sample, so the sums keep their precision
+	double origin = history -> ring[0].time;
+	for (size_t i = 0; i < n; i ++) {
+		mean_t += history -> ring[i].time - origin;
+		mean_n += history -> ring[i].fd_num;
 	}
-	fprintf(output_txt, "%s", line);
-	// Close the file after writing
-	fclose(output_txt);
+	mean_t /= n;
+	mean_n /= n;
+	for (size_t i = 0; i < n; i ++) {
+		double dt = history -> ring[i].time - origin - mean_t;
+		cov += dt * (history -> ring[i].fd_num - mean_n);
+		var += dt * dt;
+	}
+	return var > 0 ? cov / var : 0;
 }
 
-/** @brief Output the composite FD table into a binary file.
- * 
- * 	If a process ID is provided, the function outputs the composite table for that
- * 	specific process. Otherwise outputs the composite tables for all processes owned
- *  by the current user.
- * 
- *  @param pid - An integer that represents the process ID.
+/** @brief Format a duration as e.g. "45s", "12m05s" or "3h20m".
+ *
+ *  @param seconds - The duration.
+ *  @param buf - The string to store the duration in.
+ *  @param size - The size of buf.
  *  @return Void.
  */
-void output_binary(int pid) {
-	int m = -1;
+void format_duration(double seconds, char *buf, size_t size) {
+	long s = (long) seconds;
+	if (s < 60) {
+		snprintf(buf, size, "%lds", s);
+	} else if (s < 3600) {
+		snprintf(buf, size, "%ldm%02lds", s / 60, s % 60);
+	} else {
+		snprintf(buf, size, "%ldh%02ldm", s / 3600, s % 3600 / 60);
+	}
+}
 
-	// Storing the divided line and the composite title
-	char title[50];
-   	char *line = "\t========================================\n";
-   	sprintf(title, ">>> target PID: %d\n\tPID\tFD\tFilename\t\tInode\n", pid);
+/** @brief Sample the FD counts and alert on the processes whose count is growing.
+ *
+ *  Every interval, the FDs of the processes accepted by the filter are
+ *  counted (only the fd directories are enumerated) and appended to each
+ *  process' history. The growth rate of a process is the least-squares slope
+ *  of its window, and the time it has left is projected from the rate and its
+ *  soft limit on open files. A process is reported once its window holds
+ *  LEAK_MIN_SAMPLES samples (or a full smaller window), if it grows by at
+ *  least rate FDs per minute or would reach its limit within horizon seconds.
+ *  Histories of exited processes are dropped, so memory only depends on the
+ *  number of processes.
+ *
+ *  @param options - A pointer to the scanner options.
+ *  @param interval - Seconds between samples.
+ *  @param window - The number of samples kept per process.
+ *  @param rate - The growth (FDs per minute) that raises an alert.
+ *  @param horizon - The projected time to the limit (seconds) that raises an alert.
+ *  @return Void (the function never returns).
+ */
+void leak_watch(const fdt_options *options, double interval, size_t window, double rate,
+	double horizon) {
+	struct timespec delay = {(time_t) interval,
+		(long) ((interval - (time_t) interval) * 1e9)};
+	char *line = "\t========================================\n";
+	fd_history *histories = NULL;  // The histories of the previous sample, sorted by PID
+	size_t history_count = 0;
+	size_t min_samples = window < LEAK_MIN_SAMPLES ? window : LEAK_MIN_SAMPLES;
 
-	// Create a binary file to store the output information
-	FILE *output_binary = fopen("compositeTable.bin", "wb"); // write only
+	while (1) {
+		fd_count *counts;
+		struct timespec ts;
+		ssize_t counted = count_files(&counts, options, 1);
+		if (counted == -1) {
+			scan_failed();
+		}
+		size_t count = counted;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		double now = ts.tv_sec + ts.tv_nsec / 1e9;
 
-	// test for files not existing (i.e. fopen fails)
-	if (output_binary == NULL) {
-		perror("fopen");
-	}
+		// Carry each process' history over (a new start time means a reused
+		// PID) and append the new sample to it
+		fd_history *next = malloc((count > 0 ? count : 1) * sizeof(fd_history));
+		if (next == NULL) {
+			handle_error("Out of memory while sampling file descriptor counts!");
+		}
+		for (size_t i = 0; i < count; i ++) {
+			fd_history key = {counts[i].pid, 0, 0, 0, NULL};
+			fd_history *old = history_count == 0 ? NULL : bsearch(&key, histories, history_count,
+				sizeof(fd_history), compare_histories);
+			fd_history *history = &next[i];
+			if (old != NULL && old -> ring != NULL && old -> starttime == counts[i].starttime) {
+				*history = *old;
+				old -> ring = NULL;
+			} else {
+				*history = key;
+				history -> starttime = counts[i].starttime;
+				if ((history -> ring = malloc(window * sizeof(fd_sample))) == NULL) {
+					handle_error("Out of memory while sampling file descriptor counts!");
+				}
+			}
+			history -> ring[history -> next].time = now;
+			history -> ring[history -> next].fd_num = counts[i].fd_num;
+			history -> next = (history -> next + 1) % window;
+			if (history -> count < window) {
+				history -> count ++;
+			}
+		}
+		for (size_t i = 0; i < history_count; i ++) {
+			free(histories[i].ring);
+		}
+		free(histories);
+		free(counts);
+		histories = next;
+		history_count = count;
+		qsort(histories, history_count, sizeof(fd_history), compare_histories);
 
-	// Write the title information to the file
-	fwrite(title, 1, sizeof(title), output_binary);
-	fwrite(line, 1, sizeof(line), output_binary);
-	if (pid != -1) {
-		// Pass the file pointer to show_FD to write the FD information
-		show_FD(pid, -1, &m, 0, 0, 0, 0, NULL, output_binary);
-	} else {
-		// Pass the file pointer to find_files and let find_files loop each
-		// process then call show_FD to write the FD information
-		find_files(-1, 0, 0, 0, 0, NULL, output_binary);
+		// Report the processes that grow too fast or run out of FDs too soon
+		char when[32];       // The formatted time of the sample
+		time_t wall = time(NULL);
+		int alerts = 0;
+		strftime(when, sizeof(when), "%H:%M:%S", localtime(&wall));
+		for (size_t i = 0; i < history_count; i ++) {
+			fd_history *history = &histories[i];
+			double slope = history_slope(history);
+			if (history -> count < min_samples || !(slope > 0)) {
+				continue;
+			}
+			int fd_num = history -> ring[(history -> next + window - 1) % window].fd_num;
+			long limit = read_fd_limit_value(options -> proc_root, history -> pid);
+			double left = limit > 0 ? (limit - fd_num) / slope : -1;
+			if (slope * 60 < rate && (left < 0 || left > horizon)) {
+				continue;
+			}
+			if (alerts ++ == 0) {
+				printf(">>> leak alerts at %s\n\tPID\tFD\tLimit\tFD/min\tLimit in\n%s", when, line);
+			}
+			char limit_text[32], left_text[32];
+			snprintf(limit_text, sizeof(limit_text), limit > 0 ? "%ld" : "unlimited", limit);
+			if (left >= 0) {
+				format_duration(left, left_text, sizeof(left_text));
+			} else {
+				snprintf(left_text, sizeof(left_text), "never");
+			}
+			printf("\t%d\t%d\t%s\t%.1f\t%s\n", history -> pid, fd_num, limit_text, slope * 60,
+				left_text);
+		}
+		if (alerts > 0) {
+			printf("%s", line);
+		}
+		printf(">>> sample at %s: %zu processes, %d alerts\n", when, history_count, alerts);
+		fflush(stdout);
+		nanosleep(&delay, NULL);
 	}
-	fwrite(line, 1, sizeof(line), output_binary);
-	// Close the file after writing
-	fclose(output_binary);
 }
 
 /** @brief Validate the command line arguments user gived.
@@ -408,51 +2515,209 @@ void output_binary(int pid) {
  *
  *  @param argc Number of ommand line arguments.
  *  @param argv The array of strings storing command line arguments.
- *  @param per_process - Point to an integer to indicate if "--per-process" is been called
- *  @param sysWide - Point to an integer to indicate if "--systemWide" is been called
- *  @param vnode - Point to an integer to indicate if "--Vnodes" is been called
- *  @param composite - Point to an integer to indicate if "--composite" is been called
- *  @param txt - Point to an integer to indicate if "--output_TXT" is been called
- *  @param binary - Point to an integer to indicate if "--output_binary" is been called
- *  @param pid - A pointer to an integer that represents the process ID
- *  @param threshold - A pointer to an integer used to specify a file descriptor limit.
- * 					   Set if "--threshold=X" is been called
- *  @return Void.
- */
-void vertify_arg(int argc, char *argv[], int *per_process, int *sysWide, int *vnode,
-	int *composite, int *txt, int *binary, int *pid, int *threshold) {
-	int tmp_pid, tmp_threshold; // Store temporary pid / threshold valus
+ *  @param opt - A pointer to the options to fill (see fd_options).
+ *  @return Void.
+ */
+void vertify_arg(int argc, char *argv[], fd_options *opt) {
+	int tmp_pid, tmp_threshold, tmp_jobs, tmp_top, tmp_uid; // Store temporary argument valus
+	int tmp_batch;              // Store the temporary statx batch size
+	int tmp_window;             // Store the temporary leak window
+	int tmp_min, tmp_max;       // Store temporary PID range values
+
+	// The proc root must be known before a positional PID is validated, and
+	// stdout must be counted before anything is printed on it
+	for (int i = 1; i < argc; i ++) {
+		if (strncmp(argv[i], "--proc-root=", 12) == 0 && argv[i][12] != '\0') {
+			opt -> scan.proc_root = argv[i] + 12;
+		} else if (strcmp(argv[i], "--stats") == 0 || strcmp(argv[i], "--stats=json") == 0) {
+			if (stats == NULL) {
+				stats = &stats_data;
+				stats -> started = run_clock();
+				opt -> scan.stats = &stats -> scan;
+				count_stdout();
+			}
+			stats -> json = argv[i][7] == '=';
+		}
+	}
+
 	for (int i = 1; i < argc; i ++) {
         // Loop the command line arguments for verifying
         // If a specific argument is been called, set the corresponding flag to 1
         if (strcmp(argv[i], "--per-process") == 0) {
-        	*per_process = 1;
+        	opt -> per_process = 1;
         } else if (strcmp(argv[i], "--systemWide") == 0) {
-        	*sysWide = 1;
+        	opt -> sysWide = 1;
         } else if (strcmp(argv[i], "--Vnodes") == 0) {
-        	*vnode = 1;
+        	opt -> vnode = 1;
         } else if (strcmp(argv[i], "--composite") == 0) {
-        	*composite = 1;
+        	opt -> composite = 1;
         } else if (sscanf(argv[i], "--threshold=%d", &tmp_threshold) == 1) {
         	// If user calls "--threshold=X" multiple times with different values,
         	// or if the threshold value is a negative number, report an error
-        	if (*threshold != -1 && *threshold != tmp_threshold) {
+        	if (opt -> threshold != -1 && opt -> threshold != tmp_threshold) {
         		handle_error("The value given to --threshold=X should be consistent!");
         	} else if (tmp_threshold < 0) {
         		handle_error("The value given to --threshold=X should be a positive int!");
         	}
         	// Otherwise set the threshold value to the user's input
-        	*threshold = tmp_threshold;
+        	opt -> threshold = tmp_threshold;
+        } else if (sscanf(argv[i], "--jobs=%d", &tmp_jobs) == 1) {
+        	// The number of scanner threads should be a positive number
+        	if (tmp_jobs < 1) {
+        		handle_error("The value given to --jobs=N should be a positive int!");
+        	}
+        	opt -> scan.jobs = tmp_jobs;
+        } else if (sscanf(argv[i], "--top=%d", &tmp_top) == 1) {
+        	// The number of reported processes should be a positive number
+        	if (tmp_top < 1) {
+        		handle_error("The value given to --top=K should be a positive int!");
+        	}
+        	opt -> top = tmp_top;
+        } else if (sscanf(argv[i], "--uid=%d", &tmp_uid) == 1) {
+        	if (tmp_uid < 0) {
+        		handle_error("The value given to --uid=N should be a positive int!");
+        	}
+        	opt -> scan.filter.uid = tmp_uid;
+        } else if (strcmp(argv[i], "--all-users") == 0) {
+        	// Only a privileged user can read the FD tables of other users
+        	if (geteuid() != 0) {
+        		handle_error("--all-users can only be used by a privileged user!");
+        	}
+        	opt -> scan.filter.all_users = 1;
+        } else if (strncmp(argv[i], "--comm=", 7) == 0 && argv[i][7] != '\0') {
+        	opt -> scan.filter.comm = argv[i] + 7;
+        } else if (strncmp(argv[i], "--pid-range=", 12) == 0) {
+        	// Accept "A-B" and the open-ended "A-"
+        	int n = sscanf(argv[i] + 12, "%d-%d", &tmp_min, &tmp_max);
+        	if (n < 1 || tmp_min < 0 || (n == 2 && tmp_max < tmp_min) ||
+        		(n == 1 && argv[i][strlen(argv[i]) - 1] != '-')) {
+        		handle_error("The value given to --pid-range=A-B should be a range of PIDs!");
+        	}
+        	opt -> scan.filter.pid_min = tmp_min;
+        	opt -> scan.filter.pid_max = n == 2 ? tmp_max : -1;
+        } else if (strncmp(argv[i], "--dump=", 7) == 0 && argv[i][7] != '\0') {
+        	opt -> dump = argv[i] + 7;
+        } else if (strncmp(argv[i], "--query=", 8) == 0 && argv[i][8] != '\0') {
+        	// A query prints the matching records of a snapshot like --dump=FILE
+        	opt -> dump = argv[i] + 8;
+        } else if (strcmp(argv[i], "--diff") == 0) {
+        	if (i + 2 >= argc) {
+        		handle_error("--diff takes two binary snapshot files: --diff OLD NEW!");
+        	}
+        	opt -> diff[0] = argv[++ i];
+        	opt -> diff[1] = argv[++ i];
+        } else if (sscanf(argv[i], "--pid=%d", &tmp_pid) == 1) {
+        	if (tmp_pid < 0) {
+        		handle_error("The value given to --pid=N should be a positive int!");
+        	}
+        	opt -> query_pid = tmp_pid;
+        } else if (strncmp(argv[i], "--path-prefix=", 14) == 0 && argv[i][14] != '\0') {
+        	opt -> prefix = argv[i] + 14;
+        } else if (strncmp(argv[i], "--format=", 9) == 0) {
+        	if (strcmp(argv[i] + 9, "csv") == 0) {
+        		opt -> format = TABLE_CSV;
+        	} else if (strcmp(argv[i] + 9, "jsonl") == 0) {
+        		opt -> format = TABLE_JSONL;
+        	} else if (strcmp(argv[i] + 9, "table") == 0) {
+        		opt -> format = 0;
+        	} else {
+        		handle_error("The value given to --format= should be table, csv or jsonl!");
+        	}
+        } else if (strcmp(argv[i], "--resolve-sockets") == 0) {
+        	opt -> resolve = 1;
+        } else if (strcmp(argv[i], "--fdinfo") == 0) {
+        	opt -> fdinfo = 1;
+        } else if (strcmp(argv[i], "--stream") == 0) {
+        	opt -> stream = STREAM_QUEUE;
+        } else if (strncmp(argv[i], "--stream=", 9) == 0) {
+        	// The queue holds at least one process
+        	char *end;
+        	long queue = strtol(argv[i] + 9, &end, 10);
+        	if (end == argv[i] + 9 || *end != '\0' || queue < 1) {
+        		handle_error("The value given to --stream=N should be a positive int!");
+        	}
+        	opt -> stream = queue;
+        } else if (strncmp(argv[i], "--cgroup=", 9) == 0 && argv[i][9] != '\0') {
+        	if (read_cgroup_pids(argv[i] + 9, &opt -> pids, &opt -> pid_count,
+        		&opt -> pid_cap) != 0) {
+        		perror(argv[i] + 9);
+        		handle_error("The value given to --cgroup=PATH should be a cgroup directory!");
+        	}
+        	opt -> pid_set = 1;
+        } else if (strncmp(argv[i], "--pidfile=", 10) == 0 && argv[i][10] != '\0') {
+        	if (read_pid_file(AT_FDCWD, argv[i] + 10, &opt -> pids, &opt -> pid_count,
+        		&opt -> pid_cap) != 0) {
+        		perror(argv[i] + 10);
+        		handle_error("The value given to --pidfile=FILE should be a file of PIDs!");
+        	}
+        	opt -> pid_set = 1;
+        } else if (strcmp(argv[i], "--io=sync") == 0 || strcmp(argv[i], "--io=uring") == 0) {
+        	opt -> scan.io = strcmp(argv[i], "--io=uring") == 0 ? FDT_IO_URING : FDT_IO_SYNC;
+        } else if (strncmp(argv[i], "--io=", 5) == 0) {
+        	handle_error("The value given to --io= should be sync or uring!");
+        } else if (sscanf(argv[i], "--io-batch=%d", &tmp_batch) == 1) {
+        	if (tmp_batch < 1 || tmp_batch > FDT_IO_BATCH_MAX) {
+        		handle_error("The value given to --io-batch=N should be between 1 and 4096!");
+        	}
+        	opt -> scan.io_batch = tmp_batch;
+        } else if (strcmp(argv[i], "--threads") == 0) {
+        	opt -> scan.filter.tasks = 1;
+        } else if (strcmp(argv[i], "--files") == 0) {
+        	opt -> files = 1;
+        } else if (sscanf(argv[i], "--inode=%ld", &opt -> inode) == 1) {
+        	if (opt -> inode <= 0) {
+        		handle_error("The value given to --inode=N should be a positive int!");
+        	}
+        	opt -> files = 1;
+        } else if (strncmp(argv[i], "--path=", 7) == 0 && argv[i][7] != '\0') {
+        	opt -> path = argv[i] + 7;
+        	opt -> files = 1;
+        } else if (strncmp(argv[i], "--watch=", 8) == 0) {
+        	// The interval is a positive number of seconds (e.g. 0.5)
+        	char *end;
+        	opt -> watch = strtod(argv[i] + 8, &end);
+        	if (end == argv[i] + 8 || *end != '\0' || !(opt -> watch > 0)) {
+        		handle_error("The value given to --watch=INTERVAL should be a positive "
+        			"number of seconds!");
+        	}
+        } else if (strncmp(argv[i], "--leak-watch=", 13) == 0) {
+        	// The interval is a positive number of seconds (e.g. 0.5)
+        	char *end;
+        	opt -> leak_watch = strtod(argv[i] + 13, &end);
+        	if (end == argv[i] + 13 || *end != '\0' || !(opt -> leak_watch > 0)) {
+        		handle_error("The value given to --leak-watch=INTERVAL should be a positive "
+        			"number of seconds!");
+        	}
+        } else if (sscanf(argv[i], "--leak-window=%d", &tmp_window) == 1) {
+        	// A slope needs two samples; the ring size bounds the memory per process
+        	if (tmp_window < 2 || tmp_window > LEAK_WINDOW_MAX) {
+        		handle_error("The value given to --leak-window=N should be between 2 and 1024!");
+        	}
+        	opt -> leak_window = tmp_window;
+        } else if (strncmp(argv[i], "--leak-rate=", 12) == 0) {
+        	char *end;
+        	opt -> leak_rate = strtod(argv[i] + 12, &end);
+        	if (end == argv[i] + 12 || *end != '\0' || !(opt -> leak_rate > 0)) {
+        		handle_error("The value given to --leak-rate=R should be a positive "
+        			"number of FDs per minute!");
+        	}
+        } else if (strncmp(argv[i], "--leak-horizon=", 15) == 0) {
+        	char *end;
+        	opt -> leak_horizon = strtod(argv[i] + 15, &end);
+        	if (end == argv[i] + 15 || *end != '\0' || !(opt -> leak_horizon >= 0)) {
+        		handle_error("The value given to --leak-horizon=S should be a number of seconds!");
+        	}
+        } else if ((strncmp(argv[i], "--proc-root=", 12) == 0 && argv[i][12] != '\0') ||
+        	strcmp(argv[i], "--stats") == 0 || strcmp(argv[i], "--stats=json") == 0) {
+        	// Already handled above
         } else if (sscanf(argv[i], "%d", &tmp_pid) == 1) {
         	// Create a path to the process corresponding to the PID
-			char path[50];
-    		sprintf(path, "/proc/%d", tmp_pid);
-
-        	// If there are more than one positional arguments, or the positional
-        	// argument is negative, or no such pid exits, report an error
-        	if (*pid != -1) {
-        		handle_error("Can only take one positional argument indicating a PID!");
-        	} else if (tmp_pid < 0) {
+			char path[PATH_MAX];
+    		snprintf(path, sizeof(path), "%s/%d", opt -> scan.proc_root, tmp_pid);
+
+        	// If the positional argument is negative, or no such pid exits,
+        	// report an error
+        	if (tmp_pid < 0) {
         		handle_error("Can only take a positive integer indicating a PID!");
         	} else if (access(path, F_OK) != 0) {
         		// If the process id doesn't exist, print an error message
@@ -460,56 +2725,243 @@ void vertify_arg(int argc, char *argv[], int *per_process, int *sysWide, int *vn
     			sprintf(message, "PID '%d' entered does not exist!", tmp_pid);
         		handle_error(message);
    			} else {
-   				// Otherwise set the process id to the user's input
-        		*pid = tmp_pid;
-   				// Print a title
-   				printf(">>> target PID: %d\n", *pid);
+   				// Otherwise add the process id to the user's PIDs
+   				if (grow_array((void **) &opt -> pids, &opt -> pid_cap, opt -> pid_count,
+   					sizeof(int)) != 0) {
+   					handle_error("Out of memory while reading the PIDs!");
+   				}
+        		opt -> pids[opt -> pid_count ++] = tmp_pid;
    			}
         } else if (strcmp(argv[i], "--output_TXT") == 0) {
-        	*txt = 1;
+        	opt -> txt = 1;
         } else if (strcmp(argv[i], "--output_binary") == 0) {
-        	*binary = 1;
+        	opt -> binary = 1;
         } else {
         	// If the statement is in other format, print an error message
             printf("Invalid arguments: \"%s\"\n", argv[i]);
             exit(0);
         }
     }
+
+	// A single positional PID is displayed as the target process. Several
+	// PIDs, "--cgroup=" and "--pidfile=" form a PID set instead: only those
+	// processes are visited (regardless of their owner, like a target PID)
+	// and /proc is not enumerated.
+	if (opt -> pid_count == 1 && !opt -> pid_set) {
+		opt -> pid = opt -> pids[0];
+	} else if (opt -> pid_count > 0 || opt -> pid_set) {
+		opt -> pid_count = sort_pids(opt -> pids, opt -> pid_count);
+		opt -> scan.filter.pids = opt -> pids;
+		opt -> scan.filter.pid_count = opt -> pid_count;
+		opt -> scan.filter.all_users = 1;
+	}
+}
+
+/** @brief Work out which fields the requested outputs read.
+ *
+ *  The scan fetches nothing else: the per-process table needs no system call
+ *  per FD, the vnode table only a stat and the system-wide table only a
+ *  readlink. The fdinfo fields are only read for "--fdinfo".
+ *
+ *  @param opt - A pointer to the validated options.
+ *  @return The FDT_FIELD_* flags to scan with.
+ */
+int required_fields(const fd_options *opt) {
+	int fields = 0;
+	// These outputs read every column, or compare records by file
+	if (opt -> composite || opt -> files || opt -> txt || opt -> binary || opt -> resolve ||
+		opt -> watch > 0 || opt -> format != 0) {
+		fields |= FDT_FIELDS_ALL;
+	}
+	if (opt -> sysWide) {
+		fields |= FDT_FIELD_LINK;
+	}
+	if (opt -> vnode) {
+		fields |= FDT_FIELD_STAT;
+	}
+	if (opt -> fdinfo) {
+		fields |= FDT_FIELD_FDINFO;
+	}
+	if (opt -> resolve) {
+		fields |= FDT_FIELD_ACCESS;
+	}
+	return fields;
 }
 
 int main (int argc, char *argv[]) {
 	// Initialize the pid and the threshold to a negative value, indicating
-	// user has not set values for these two variables
-	int pid = -1;
-	int threshold = -1;
-
-	// Create flags for each argument to check if they're being called
-	int per_process = 0, sysWide = 0, vnode = 0, composite = 0;
-	int txt = 0, binary = 0;
+	// user has not set values for these two variables. The filter and the
+	// number of threads start from the library defaults (the current user,
+	// one thread per online CPU).
+	fd_options opt = {0};
+	fdt_default_options(&opt.scan);
+	opt.pid = -1;
+	opt.threshold = -1;
+	opt.top = -1;
+	opt.query_pid = -1;
+	opt.leak_window = LEAK_WINDOW;
+	opt.leak_rate = LEAK_RATE;
+	opt.leak_horizon = LEAK_HORIZON;
 
 	// Validate the command line arguments
-	vertify_arg(argc, argv, &per_process, &sysWide, &vnode, &composite,
-		&txt, &binary, &pid, &threshold);
+	vertify_arg(argc, argv, &opt);
+	// Print a title, unless the output is machine-readable
+	if (opt.pid != -1 && opt.format == 0) {
+		printf(">>> target PID: %d\n", opt.pid);
+	}
+
+	// "--dump=FILE", "--query=FILE" and "--diff OLD NEW" read saved binary
+	// snapshots instead of scanning /proc
+	record_query query = {opt.query_pid, opt.inode, opt.prefix,
+		opt.prefix != NULL ? strlen(opt.prefix) : 0};
+	if (opt.diff[0] != NULL) {
+		return diff_binary(opt.diff[0], opt.diff[1], &opt.scan.filter, &query,
+			opt.format) == 0 ? 0 : 1;
+	}
+	if (opt.dump != NULL) {
+		return dump_binary(opt.dump, &opt.scan.filter, &query, opt.format) == 0 ? 0 : 1;
+	}
+	if (opt.query_pid != -1 || opt.prefix != NULL) {
+		handle_error("--pid=N and --path-prefix=P only apply to --query=FILE and --diff OLD NEW!");
+	}
+	// A refresh only visits processes, so the threads' records would look closed
+	if (opt.scan.filter.tasks && opt.watch > 0) {
+		handle_error("--threads cannot be used with --watch=INTERVAL!");
+	}
+
+	// "--leak-watch=INTERVAL" is a sampling mode of its own: it only counts
+	// FDs, and runs until interrupted
+	if (opt.leak_watch > 0) {
+		if (opt.per_process || opt.sysWide || opt.vnode || opt.composite || opt.files ||
+			opt.fdinfo || opt.txt || opt.binary || opt.threshold != -1 || opt.top != -1 ||
+			opt.watch > 0 || opt.stream > 0) {
+			handle_error("--leak-watch=INTERVAL cannot be combined with tables, exports, "
+				"--threshold, --top, --watch or --stream!");
+		}
+		if (opt.pid != -1) {
+			opt.scan.filter.pid_min = opt.scan.filter.pid_max = opt.pid;
+			opt.scan.filter.all_users = 1;
+			opt.scan.filter.comm = NULL;
+		}
+		leak_watch(&opt.scan, opt.leak_watch, opt.leak_window, opt.leak_rate,
+			opt.leak_horizon);
+	}
+
+	// "--top=K" is a lightweight alerting mode: it needs a threshold, and it
+	// only displays tables that are explicitly requested
+	if (opt.top != -1 && opt.threshold == -1) {
+		opt.threshold = 0;
+	}
+
+	// Default behaviour: if no table flag is passed to the program,
+	// the program will display the composite table
+	int tables = opt.per_process || opt.sysWide || opt.vnode || opt.composite || opt.files ||
+		opt.fdinfo;
+	if (!tables && (opt.top == -1 || opt.watch > 0)) {
+		opt.composite = 1;
+		tables = 1;
+	}
+
+	// Scan /proc once; every table and export below is rendered from this snapshot
+	opt.scan.fields = required_fields(&opt);
+	fdt_scanner *scanner = fdt_open(&opt.scan);
+	if (scanner == NULL) {
+		handle_error("Out of memory while building the FD snapshot!");
+	}
+	// With "--stream", the rows are written while /proc is being scanned
+	if (opt.stream > 0) {
+		int status = stream_tables(scanner, &opt) == 0 ? 0 : 1;
+		if (stats != NULL) {
+			print_stats();
+		}
+		fdt_close(scanner);
+		free(opt.pids);
+		return status;
+	}
+
+	fdt_snapshot *snap = fdt_get_snapshot(scanner);
+	if (tables || opt.txt || opt.binary) {
+		if (fdt_scan(scanner, opt.pid) == -1) {
+			scan_failed();
+		}
+		if (opt.resolve) {
+			uint64_t start = run_clock();
+			resolve_endpoints(snap, &opt.scan);
+			run_phase(PHASE_RESOLVE, start);
+		}
+	}
 
 	// Print the FD tables in the requested format
-	show_tables(pid, per_process, sysWide, vnode, composite);
+	uint64_t start = run_clock();
+	show_tables(snap, opt.pid, opt.per_process, opt.sysWide, opt.vnode, opt.composite,
+		opt.fdinfo, opt.format);
+	if (opt.files) {
+		show_files(snap, opt.inode, opt.path);
+	}
+	run_phase(PHASE_TABLES, start);
 
 	// If a threshold is set, display the process ID if and the number of FD
 	// assigned for that process if the number of FD assigned to that process
-	// exceeds the threshold.
-	if (threshold != -1) {
-		show_theshold(threshold);
+	// exceeds the threshold. The counts come from the snapshot if it covers
+	// all user-owned processes, otherwise from a count-only scan.
+	if (opt.threshold != -1) {
+		fd_count *counts = NULL;
+		size_t count;
+		if (opt.pid == -1 && (tables || opt.txt || opt.binary)) {
+			count = snap -> proc_count;
+			if (count > 0 && (counts = malloc(count * sizeof(fd_count))) == NULL) {
+				handle_error("Out of memory while counting file descriptors!");
+			}
+			for (size_t i = 0; i < count; i ++) {
+				counts[i].pid = snap -> procs[i].pid;
+				counts[i].fd_num = snap -> procs[i].fd_num;
+				counts[i].starttime = 0;
+			}
+		} else {
+			ssize_t counted = count_files(&counts, &opt.scan, 0);
+			if (counted == -1) {
+				scan_failed();
+			}
+			count = counted != -1 ? counted : 0;
+		}
+		start = run_clock();
+		show_theshold(counts, count, opt.threshold, opt.top, opt.scan.proc_root);
+		run_phase(PHASE_TABLES, start);
+		free(counts);
 	}
 
 	// If the user wants to output the composite table as a text file
-	if (txt == 1) {
-		output_txt(pid);
+	if (opt.txt == 1) {
+		start = run_clock();
+		output_txt(snap, opt.pid);
+		run_phase(PHASE_TXT, start);
 	}
 
 	// If the user wants to output the composite table as a binary file
-	if (binary == 1) {
-		output_binary(pid);
+	int status = 0;
+	if (opt.binary == 1) {
+		start = run_clock();
+		status = output_binary(snap, opt.pid) == 0 ? 0 : 1;
+		run_phase(PHASE_BINARY, start);
+	}
+
+	// With "--stats", report the instrumentation of the scan above on stderr
+	if (stats != NULL) {
+		print_stats();
+	}
+
+	// In watch mode, keep the snapshot and print only what changes. A given
+	// PID is watched regardless of its owner.
+	if (opt.watch > 0) {
+		if (opt.pid != -1) {
+			opt.scan.filter.pid_min = opt.scan.filter.pid_max = opt.pid;
+			opt.scan.filter.all_users = 1;
+			opt.scan.filter.comm = NULL;
+		}
+		watch_files(snap, &opt.scan, opt.watch);
 	}
 
-    return 0;
+	fdt_close(scanner);
+	free(opt.pids);
+    return status;
 }
\ No newline at end of file
@@ -0,0 +1,99 @@
+#!/bin/sh
+# Check that damaged binary snapshots are rejected with an error instead of
+# being read out of bounds by --dump, --query and --diff, and that --diff
+# joins snapshots whose records are out of order. Also check that a failed
+# --output_binary write is reported.
+#
+# Usage: tests/test_bin_snapshot.sh [path/to/showFDtables]
+
+BIN=$(cd "$(dirname "${1:-./showFDtables}")" && pwd)/$(basename "${1:-./showFDtables}")
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+cd "$DIR" || exit 1
+FAILED=0
+
+# expect STATUS PATTERN ARGS...: run showFDtables and check its exit status
+# and that its output contains PATTERN
+expect() {
+	status=$1
+	pattern=$2
+	shift 2
+	"$BIN" "$@" >out.txt 2>&1
+	got=$?
+	if [ "$got" -ne "$status" ] || ! grep -q -- "$pattern" out.txt; then
+		echo "FAIL: showFDtables $* (exit $got, expected $status and '$pattern')"
+		sed 's/^/    /' out.txt
+		FAILED=1
+	else
+		echo "ok: showFDtables $*"
+	fi
+}
+
+# patch FILE OFFSET BYTES: overwrite bytes of FILE (BYTES is a printf format)
+patch() {
+	printf "$3" | dd of="$1" bs=1 seek="$2" conv=notrunc 2>/dev/null
+}
+
+# A valid snapshot of this shell
+"$BIN" --output_binary $$ >/dev/null 2>&1
+if [ ! -s compositeTable.bin ]; then
+	echo "FAIL: showFDtables --output_binary did not write compositeTable.bin"
+	exit 1
+fi
+cp compositeTable.bin good.bin
+expect 0 "FD" --dump=good.bin
+
+# A file shorter than the header
+head -c 64 good.bin >truncated.bin
+expect 1 "is not a binary FD snapshot" --dump=truncated.bin
+
+# A file cut inside its records
+head -c 140 good.bin >short.bin
+expect 1 "is not a valid binary FD snapshot" --dump=short.bin
+
+# A header_size (offset 12) of 1000000, larger than the file, with one record
+# (offset 24) and a string table (offset 32) right after it
+cp good.bin header.bin
+patch header.bin 12 '\100\102\017\000'
+patch header.bin 24 '\001\000\000\000\000\000\000\000'
+patch header.bin 32 '\140\102\017\000\000\000\000\000'
+expect 1 "is not a valid binary FD snapshot" --dump=header.bin
+
+# A record_count (offset 24) of 2^62
+cp good.bin count.bin
+patch count.bin 24 '\000\000\000\000\000\000\000\100'
+expect 1 "is not a valid binary FD snapshot" --dump=count.bin
+
+# --diff and --query open their files the same way
+for bad in truncated.bin header.bin count.bin; do
+	expect 1 "not a.*binary FD snapshot" --diff good.bin $bad
+	expect 1 "not a.*binary FD snapshot" --diff $bad good.bin
+	expect 1 "not a.*binary FD snapshot" --query=$bad
+done
+
+# A snapshot whose first two records are swapped is sorted before the join,
+# so it has no difference with the original
+cp good.bin swapped.bin
+dd if=good.bin of=swapped.bin bs=32 skip=5 seek=4 count=1 conv=notrunc 2>/dev/null
+dd if=good.bin of=swapped.bin bs=32 skip=4 seek=5 count=1 conv=notrunc 2>/dev/null
+if cmp -s good.bin swapped.bin; then
+	echo "FAIL: the records of swapped.bin were not swapped"
+	FAILED=1
+fi
+expect 0 ">>> 0 opened, 0 closed" --diff good.bin swapped.bin
+expect 0 ">>> 0 opened, 0 closed" --diff swapped.bin good.bin
+
+# A failed write is an error and leaves no corrupt snapshot behind
+if [ -w /dev/full ]; then
+	for stream in "" --stream; do
+		rm -f compositeTable.bin
+		ln -s /dev/full compositeTable.bin
+		expect 1 "compositeTable.bin: No space left on device" $stream --output_binary $$
+		if [ -e compositeTable.bin ] || [ -L compositeTable.bin ]; then
+			echo "FAIL: showFDtables $stream --output_binary left compositeTable.bin behind"
+			FAILED=1
+		fi
+	done
+fi
+
+exit $FAILED
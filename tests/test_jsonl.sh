@@ -0,0 +1,47 @@
+#!/bin/sh
+# Check that --format=jsonl writes valid UTF-8 JSON for file names that are
+# not valid UTF-8: such bytes are escaped as \u00XX, valid sequences are kept.
+#
+# Usage: tests/test_jsonl.sh [path/to/showFDtables]
+
+BIN=$(cd "$(dirname "${1:-./showFDtables}")" && pwd)/$(basename "${1:-./showFDtables}")
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+cd "$DIR" || exit 1
+FAILED=0
+export LC_ALL=C
+
+# Open files whose names hold a valid two-byte sequence (U+00E9), a stray
+# byte, an overlong encoding, a UTF-16 surrogate and a truncated sequence
+touch "$(printf 'valid\303\251')" "$(printf 'stray\377')" "$(printf 'overlong\300\200')" \
+	"$(printf 'surrogate\355\240\200')" "$(printf 'truncated\342\202')"
+exec 3<"$(printf 'valid\303\251')" 4<"$(printf 'stray\377')" \
+	5<"$(printf 'overlong\300\200')" 6<"$(printf 'surrogate\355\240\200')" \
+	7<"$(printf 'truncated\342\202')"
+
+"$BIN" --format=jsonl $$ >out.jsonl 2>&1
+
+# check PATTERN: check that a row of the output contains PATTERN
+check() {
+	if grep -q -F -- "$1" out.jsonl; then
+		echo "ok: $1"
+	else
+		echo "FAIL: no row contains $1"
+		FAILED=1
+	fi
+}
+
+check "$(printf 'valid\303\251"')"
+check 'stray\u00ff"'
+check 'overlong\u00c0\u0080"'
+check 'surrogate\u00ed\u00a0\u0080"'
+check 'truncated\u00e2\u0082"'
+
+if iconv -f UTF-8 -t UTF-8 out.jsonl >/dev/null 2>&1; then
+	echo "ok: the output is valid UTF-8"
+else
+	echo "FAIL: the output is not valid UTF-8"
+	FAILED=1
+fi
+
+exit $FAILED